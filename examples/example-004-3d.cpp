@@ -0,0 +1,61 @@
+#include <neuralfield.hpp>
+#include <chrono>
+
+// A 3D dynamic neural field, e.g. space x feature, stepped as fast as possible
+// Usage : example-004-3d [N] [nb_steps], the field being N x N x N (128 by default)
+// The target is an interactive rate, i.e. some tens of steps per second, for N = 128 ;
+// it has not been measured yet and is therefore not established. The example reports
+// the time per step and whether this rate is reached on the machine it runs on
+
+using Input = double;
+
+void fillInput(neuralfield::values_iterator begin,
+	       neuralfield::values_iterator end,
+	       const Input& x) {
+  for(; begin != end; ++begin)
+    *begin = x * neuralfield::random::uniform(0., 1.);
+}
+
+int main(int argc, char* argv[]) {
+
+  int N = argc > 1 ? std::atoi(argv[1]) : 128;
+  int nb_steps = argc > 2 ? std::atoi(argv[2]) : 20;
+  std::vector<int> shape = {N, N, N};
+  bool toric = true;
+  bool scaling = !toric;
+
+  auto net = neuralfield::network();
+
+  auto input = neuralfield::input::input<Input>(shape, fillInput, "input");
+  // The kernels are not labelled : their own values are never read,
+  // which lets them be merged in a single convolution
+  auto g_exc = neuralfield::link::gaussian(1.5, 0.05, toric, scaling, shape);
+  auto g_inh = neuralfield::link::gaussian(-1.0, 0.3, toric, scaling, shape);
+  auto fu = neuralfield::function::function("sigmoid", shape, "fu");
+  auto u = neuralfield::buffered::leaky_integrator(0.1, shape, "u");
+
+  g_exc->connect(fu);
+  g_inh->connect(fu);
+  fu->connect(u);
+  u->connect(g_exc + g_inh + input);
+
+  // The two kernels are fused in a single convolution
+  auto start = std::chrono::steady_clock::now();
+  net->init();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  net->print();
+  std::cout << "Initialization : " << elapsed.count() << " s" << std::endl;
+
+  net->set_input<Input>("input", 1.0);
+  start = std::chrono::steady_clock::now();
+  for(int i = 0 ; i < nb_steps ; ++i)
+    net->step();
+  elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << N << "x" << N << "x" << N << " field : "
+	    << 1e3 * elapsed.count() / nb_steps << " ms per step, "
+	    << nb_steps / elapsed.count() << " steps per second" << std::endl;
+  double interactive_rate = 25.0;
+  std::cout << "The interactive rate of " << interactive_rate << " steps per second is "
+	    << (nb_steps / elapsed.count() >= interactive_rate ? "" : "not ") << "reached" << std::endl;
+}
@@ -0,0 +1,217 @@
+#include <neuralfield.hpp>
+#include <cmath>
+#include <functional>
+
+// Compare every engine and strategy of the gaussian links with the baseline,
+// the FFT engine, on 1D and 2D fields, with and without wrapping
+// The program exits with a non zero status if one of them differs
+// from the baseline by more than its tolerance
+
+using Gaussian = neuralfield::link::Gaussian;
+using Setup = std::function<void(std::shared_ptr<Gaussian>)>;
+
+const double A = 1.5;
+const double s = 0.1;
+
+int nb_failures = 0;
+
+// A deterministic source, x offsetting the positions, e.g. to fill the channel x / size
+void fillInput(neuralfield::values_iterator begin,
+	       neuralfield::values_iterator end,
+	       const double& x) {
+  for(int i = int(x); begin != end; ++begin, ++i)
+    *begin = std::sin(0.7 * i) + 0.3 * ((i * 7) % 5);
+}
+
+std::vector<double> values(std::shared_ptr<neuralfield::layer::Layer> l) {
+  return std::vector<double>(l->begin(), l->end());
+}
+
+// The largest difference with the baseline, relative to its largest absolute value
+double relative_error(const std::vector<double>& v, const std::vector<double>& baseline) {
+  double error = 0.0;
+  double max_baseline = 0.0;
+  for(unsigned int i = 0 ; i < v.size() ; ++i) {
+    error = std::max(error, std::fabs(v[i] - baseline[i]));
+    max_baseline = std::max(max_baseline, std::fabs(baseline[i]));
+  }
+  return error / max_baseline;
+}
+
+void check(std::string name, std::vector<int> shape, bool toric, double error, double tolerance) {
+  bool ok = error <= tolerance;
+  std::cout << (ok ? "[ OK ] " : "[FAIL] ") << name << ", " << shape.size() << "D "
+	    << (toric ? "toric" : "non toric") << " : " << error
+	    << " (tolerance " << tolerance << ")" << std::endl;
+  if(!ok)
+    ++nb_failures;
+}
+
+// A gaussian link of the source, set up by setup, after one step
+std::shared_ptr<Gaussian> convolve(std::vector<int> shape, bool toric,
+				   Setup setup=Setup(), bool autotune=false) {
+  auto net = neuralfield::network();
+  auto input = neuralfield::input::input<double>(shape, fillInput, "input");
+  auto g = std::make_shared<Gaussian>("g", A, s, toric, !toric, shape);
+  net += g;
+  g->connect(input);
+  if(setup)
+    setup(g);
+  net->init(true, autotune);
+  net->set_input<double>("input", 0.0);
+  net->step();
+  return g;
+}
+
+// The reflective convolution, i.e. the baseline FFT convolution of the source
+// mirrored at its borders, x[-1-i] = x[i] and x[n+i] = x[n-1-i], with the full kernel
+std::vector<double> mirrored_convolution(std::vector<int> shape) {
+  bool is_2D = shape.size() == 2;
+  int h = is_2D ? shape[0] : 1;
+  int w = shape.back();
+  int h_mirrored = is_2D ? 3*h : 1;
+  int w_mirrored = 3*w;
+  int offset_h = is_2D ? h : 0;
+  int k_h = is_2D ? 2*h-1 : 1;
+  int k_w = 2*w-1;
+
+  std::vector<double> source(h*w);
+  fillInput(source.begin(), source.end(), 0.0);
+  auto mirror = [](int p, int n) { return p < 0 ? -1-p : (p >= n ? 2*n-1-p : p); };
+  std::vector<double> mirrored(h_mirrored * w_mirrored);
+  for(int i = 0 ; i < h_mirrored ; ++i)
+    for(int j = 0 ; j < w_mirrored ; ++j)
+      mirrored[i*w_mirrored + j] = source[mirror(i - offset_h, h)*w + mirror(j - w, w)];
+
+  std::vector<double> kernel(k_h * k_w);
+  for(int i = 0 ; i < k_h ; ++i)
+    for(int j = 0 ; j < k_w ; ++j) {
+      double d_h = (i - k_h/2) / double(k_h);
+      double d_w = (j - k_w/2) / double(k_w);
+      kernel[i*k_w + j] = A * exp(-(d_h*d_h + d_w*d_w) / (2.0*s*s)) / (k_h * k_w);
+    }
+
+  FFTW_Convolution::Workspace ws;
+  FFTW_Convolution::init_workspace(ws, FFTW_Convolution::LINEAR_SAME, h_mirrored, w_mirrored, k_h, k_w);
+  FFTW_Convolution::convolve(ws, mirrored.data(), kernel.data());
+  std::vector<double> result(h*w);
+  for(int i = 0 ; i < h ; ++i)
+    for(int j = 0 ; j < w ; ++j)
+      result[i*w + j] = ws.dst[(i + offset_h)*w_mirrored + j + w];
+  FFTW_Convolution::clear_workspace(ws);
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+
+  for(auto shape: std::vector<std::vector<int> >{{64}, {24, 32}})
+    for(bool toric: {false, true}) {
+      auto baseline = values(convolve(shape, toric));
+
+      // The engines
+      check("SEPARABLE", shape, toric,
+	    relative_error(values(convolve(shape, toric, [](std::shared_ptr<Gaussian> g) { g->set_engine(Gaussian::SEPARABLE); })), baseline), 1e-12);
+      Setup direct = [](std::shared_ptr<Gaussian> g) { g->set_engine(Gaussian::DIRECT); };
+      auto direct_values = values(convolve(shape, toric, direct));
+      check("DIRECT", shape, toric, relative_error(direct_values, baseline), 1e-3);
+      check("RECURSIVE", shape, toric,
+	    relative_error(values(convolve(shape, toric, [](std::shared_ptr<Gaussian> g) { g->set_engine(Gaussian::RECURSIVE); })), baseline), 5e-2);
+      if(!toric)
+	check("DCT (reflective)", shape, toric,
+	      relative_error(values(convolve(shape, toric, [](std::shared_ptr<Gaussian> g) { g->set_reflective(true); })), mirrored_convolution(shape)), 1e-12);
+
+      // The sparse mode is within the bound of its error
+      auto sparse = convolve(shape, toric, [](std::shared_ptr<Gaussian> g) { g->set_sparse(true, 0.5, 1.0); });
+      double sparse_error = 0.0;
+      auto sparse_values = values(sparse);
+      for(unsigned int i = 0 ; i < baseline.size() ; ++i)
+	sparse_error = std::max(sparse_error, std::fabs(sparse_values[i] - baseline[i]));
+      check("sparse, absolute", shape, toric, sparse_error, sparse->sparse_error_bound() + 1e-12);
+
+      // The strategies
+      check("memory lean", shape, toric,
+	    relative_error(values(convolve(shape, toric, [](std::shared_ptr<Gaussian> g) { g->set_memory_lean(true); })), baseline), 1e-12);
+      check("autotune", shape, toric, relative_error(values(convolve(shape, toric, Setup(), true)), baseline), 1e-2);
+
+      // The FFT and the DIRECT engines with every instruction set supported by the processor
+      std::string instruction_set = FFTW_Convolution::simd_instruction_set();
+      for(std::string name: {"SCALAR", "SSE2", "AVX2", "AVX512"}) {
+	if(!FFTW_Convolution::set_simd_instruction_set(name))
+	  continue;
+	check("FFT/" + name, shape, toric, relative_error(values(convolve(shape, toric)), baseline), 1e-12);
+	check("DIRECT/" + name, shape, toric, relative_error(values(convolve(shape, toric, direct)), direct_values), 1e-12);
+      }
+      FFTW_Convolution::set_simd_instruction_set(instruction_set);
+
+      // The channels convolved together, each being filled as the source of the baseline
+      {
+	int size = baseline.size();
+	int channels = 3;
+	auto net = neuralfield::network();
+	auto input = neuralfield::input::input<double>(shape, channels, fillInput, "input");
+	auto g = neuralfield::link::channel_gaussian(A, s, toric, !toric, shape, channels, {}, "g");
+	g->connect(input);
+	net->init();
+	net->set_input<double>("input", 0.0);
+	net->step();
+	auto batched = values(g);
+	double error = 0.0;
+	for(int c = 0 ; c < channels ; ++c) {
+	  auto net_c = neuralfield::network();
+	  auto input_c = neuralfield::input::input<double>(shape, fillInput, "input");
+	  auto g_c = neuralfield::link::gaussian(A, s, toric, !toric, shape, "g");
+	  g_c->connect(input_c);
+	  net_c->init();
+	  net_c->set_input<double>("input", double(c * size));
+	  net_c->step();
+	  error = std::max(error, relative_error(std::vector<double>(batched.begin() + c*size, batched.begin() + (c+1)*size), values(g_c)));
+	}
+	check("channel batching", shape, toric, error, 1e-12);
+      }
+
+      // Two layers of the same geometry, executing the same cached plans and sharing
+      // the scratch ; the workspace of the first one is kept when its parameters change
+      {
+	auto net = neuralfield::network();
+	auto input = neuralfield::input::input<double>(shape, fillInput, "input");
+	auto g1 = neuralfield::link::gaussian(A, s, toric, !toric, shape, "g1");
+	auto g2 = neuralfield::link::gaussian(-0.5*A, 3*s, toric, !toric, shape, "g2");
+	g1->connect(input);
+	g2->connect(input);
+	net->init();
+	g1->set_parameters({2*A, 2*s});
+	g1->set_parameters({A, s});
+	net->set_input<double>("input", 0.0);
+	net->step();
+	check("plan cache and scratch, first layer", shape, toric, relative_error(values(g1), baseline), 1e-12);
+	auto baseline2 = values(convolve(shape, toric, [](std::shared_ptr<Gaussian> g) { g->set_parameters({-0.5*A, 3*s}); }));
+	check("plan cache and scratch, second layer", shape, toric, relative_error(values(g2), baseline2), 1e-12);
+      }
+
+      // The sum of two convolutions, fused or not ; the fused labelled layers keep their values
+      {
+	std::vector<std::vector<double> > results[2];
+	for(int optimize = 0 ; optimize <= 1 ; ++optimize) {
+	  auto net = neuralfield::network();
+	  auto input = neuralfield::input::input<double>(shape, fillInput, "input");
+	  auto g1 = neuralfield::link::gaussian(A, s, toric, !toric, shape, "g1");
+	  auto g2 = neuralfield::link::gaussian(-0.5*A, 3*s, toric, !toric, shape, "g2");
+	  g1->connect(input);
+	  g2->connect(input);
+	  auto sum = g1 + g2;
+	  net->init(optimize);
+	  net->set_input<double>("input", 0.0);
+	  net->step();
+	  for(auto label: {"g1", "g2", "g1+g2"})
+	    results[optimize].push_back(values(net->get(label)));
+	}
+	double error = 0.0;
+	for(unsigned int k = 0 ; k < results[0].size() ; ++k)
+	  error = std::max(error, relative_error(results[1][k], results[0][k]));
+	check("fusion", shape, toric, error, 1e-12);
+      }
+    }
+
+  std::cout << nb_failures << " failure(s)" << std::endl;
+  return nb_failures == 0 ? 0 : 1;
+}
@@ -67,7 +67,7 @@ class CompetitionScenario : public Scenario {
                     // Linear convolution
                     k_shape = 2*_shape[0]-1;
                     k_center = k_shape/2;
-                    FFTW_Convolution::init_workspace(ws, FFTW_Convolution::LINEAR_SAME,  _shape[0], 1, k_shape, 1);
+                    FFTW_Convolution::init_workspace(ws, FFTW_Convolution::LINEAR_SAME,  1, _shape[0], 1, k_shape);
 
                     auto dist = neuralfield::distances::make_euclidean_1D({k_shape}, _toric);
 
@@ -3,8 +3,9 @@
 
 neuralfield::buffered::Layer::Layer(std::string label,
 		typename parameters_type::size_type number_of_parameters,
-		std::vector<int> shape):
-	neuralfield::layer::Layer(label, number_of_parameters, shape),
+		std::vector<int> shape,
+		int channels):
+	neuralfield::layer::Layer(label, number_of_parameters, shape, channels),
 	_prev(nullptr) {
 		_buffer.resize(this->size());
 		std::fill(_buffer.begin(), _buffer.end(), 0.0);
@@ -14,6 +15,10 @@ void neuralfield::buffered::Layer::connect(std::shared_ptr<neuralfield::layer::L
 	_prev = prev;
 }
 
+std::shared_ptr<neuralfield::layer::Layer> neuralfield::buffered::Layer::prev() const {
+	return _prev;
+}
+
 bool neuralfield::buffered::Layer::is_connected() {
 	return bool(_prev);
 }      
@@ -31,8 +36,9 @@ void neuralfield::buffered::Layer::swap(void) {
 
 neuralfield::buffered::LeakyIntegrator::LeakyIntegrator(std::string label,
 		double alpha,
-		std::vector<int> shape):
-	neuralfield::buffered::Layer(label, 1, shape) {
+		std::vector<int> shape,
+		int channels):
+	neuralfield::buffered::Layer(label, 1, shape, channels) {
 		_parameters[0] = alpha;
 	}
 
@@ -55,7 +61,13 @@ void neuralfield::buffered::LeakyIntegrator::update(void) {
 std::shared_ptr<neuralfield::buffered::LeakyIntegrator> neuralfield::buffered::leaky_integrator(double alpha,
 		std::vector<int> shape,
 		std::string label) {
-	auto l = std::make_shared<neuralfield::buffered::LeakyIntegrator>(neuralfield::buffered::LeakyIntegrator(label, alpha, shape));
+	return leaky_integrator(alpha, shape, 1, label);
+}
+std::shared_ptr<neuralfield::buffered::LeakyIntegrator> neuralfield::buffered::leaky_integrator(double alpha,
+		std::vector<int> shape,
+		int channels,
+		std::string label) {
+	auto l = std::make_shared<neuralfield::buffered::LeakyIntegrator>(neuralfield::buffered::LeakyIntegrator(label, alpha, shape, channels));
 
 	auto net = neuralfield::get_current_network();
 	net += l;
@@ -44,9 +44,11 @@ namespace neuralfield {
     public:
       Layer(std::string label,
 	    typename parameters_type::size_type number_of_parameters,
-	    std::vector<int> shape);
+	    std::vector<int> shape,
+	    int channels=1);
 
       void connect(std::shared_ptr<neuralfield::layer::Layer> prev);
+      std::shared_ptr<neuralfield::layer::Layer> prev() const;
 
       bool is_connected();  
       void update(void) override;
@@ -59,7 +61,8 @@ namespace neuralfield {
     public:
       LeakyIntegrator(std::string label,
 		      double alpha,
-		      std::vector<int> shape);
+		      std::vector<int> shape,
+		      int channels=1);
 	  virtual ~LeakyIntegrator();
       void update(void) override;
     };
@@ -68,6 +71,11 @@ namespace neuralfield {
 						      std::vector<int> shape,
 						      std::string label = "");
     
+    std::shared_ptr<LeakyIntegrator> leaky_integrator(double alpha,
+						      std::vector<int> shape,
+						      int channels,
+						      std::string label = "");
+    
     std::shared_ptr<LeakyIntegrator> leaky_integrator(double alpha,
 						      int size,
 						      std::string label = "");
@@ -0,0 +1,92 @@
+#include "convolution_dct.hpp"
+
+#include <algorithm>
+
+DCT_Convolution::Workspace::Workspace() {
+  h_src = w_src = 0;
+  in = spectrum = dst = 0;
+  k_in = k_out = 0;
+  p_forw = p_back = p_kernel = 0;
+}
+
+void DCT_Convolution::init_workspace(Workspace & ws, int h_src, int w_src,
+				     FFTW_Convolution::Planning_Rigor rigor, int nthreads)
+{
+  ws.h_src = h_src;
+  ws.w_src = w_src;
+
+  ws.in = (double*) fftw_malloc(sizeof(double) * h_src * w_src);
+  ws.spectrum = (double*) fftw_malloc(sizeof(double) * h_src * w_src);
+  ws.dst = (double*) fftw_malloc(sizeof(double) * h_src * w_src);
+  ws.k_in = (double*) fftw_malloc(sizeof(double) * (h_src+1) * (w_src+1));
+  ws.k_out = (double*) fftw_malloc(sizeof(double) * (h_src+1) * (w_src+1));
+
+  unsigned int flags = FFTW_Convolution::planner_flags(rigor);
+  std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+  FFTW_Convolution::plan_with_nthreads(nthreads);
+
+  // The forward transform is computed in place
+  ws.p_forw = fftw_plan_r2r_2d(h_src, w_src, ws.in, ws.in, FFTW_REDFT10, FFTW_REDFT10, flags);
+  ws.p_back = fftw_plan_r2r_2d(h_src, w_src, ws.in, ws.dst, FFTW_REDFT01, FFTW_REDFT01, flags);
+  // The kernel is only transformed when it changes, it is planned without measurement
+  ws.p_kernel = fftw_plan_r2r_2d(h_src+1, w_src+1, ws.k_in, ws.k_out, FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
+
+  if(rigor != FFTW_Convolution::ESTIMATE)
+    FFTW_Convolution::export_wisdom();
+}
+
+void DCT_Convolution::clear_workspace(Workspace & ws)
+{
+  if(ws.in)
+    {
+      fftw_free(ws.in);
+      fftw_free(ws.spectrum);
+      fftw_free(ws.dst);
+      fftw_free(ws.k_in);
+      fftw_free(ws.k_out);
+      std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+      fftw_destroy_plan(ws.p_forw);
+      fftw_destroy_plan(ws.p_back);
+      fftw_destroy_plan(ws.p_kernel);
+    }
+  ws.in = ws.spectrum = ws.dst = 0;
+  ws.k_in = ws.k_out = 0;
+  ws.p_forw = ws.p_back = ws.p_kernel = 0;
+}
+
+void DCT_Convolution::compute_kernel_spectrum(Workspace & ws, double * kernel)
+{
+  // The DCT-I over h_src+1 x w_src+1 points gives the spectrum of the kernel
+  // made symmetric with a period of 2 h_src x 2 w_src ; only its
+  // h_src x w_src first coefficients, which match those of the DCT-II, are kept.
+  int h = ws.h_src + 1;
+  int w = ws.w_src + 1;
+  std::copy(kernel, kernel + h * w, ws.k_in);
+  fftw_execute(ws.p_kernel);
+
+  // The DCT-II followed by the DCT-III scale the result by 2 h_src x 2 w_src
+  double scale = 1.0 / (4.0 * ws.h_src * ws.w_src);
+  for(int i = 0 ; i < ws.h_src ; ++i)
+    for(int j = 0 ; j < ws.w_src ; ++j)
+      ws.spectrum[i * ws.w_src + j] = scale * ws.k_out[i * w + j];
+}
+
+void DCT_Convolution::scale_kernel_spectrum(Workspace & ws, double factor)
+{
+  for(double * ptr = ws.spectrum ; ptr != ws.spectrum + ws.h_src * ws.w_src ; ++ptr)
+    *ptr *= factor;
+}
+
+void DCT_Convolution::convolve(Workspace & ws, double * src)
+{
+  int size = ws.h_src * ws.w_src;
+  std::copy(src, src + size, ws.in);
+  fftw_execute(ws.p_forw);
+
+  double * __restrict__ in = ws.in;
+  const double * __restrict__ spectrum = ws.spectrum;
+  for(int i = 0 ; i < size ; ++i)
+    in[i] *= spectrum[i];
+
+  fftw_execute(ws.p_back);
+}
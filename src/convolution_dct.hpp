@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+ *   Copyright (C) 2016,  CentraleSupelec
+ *
+ *   Author : Jeremy Fix
+ *
+ *   Contributor :
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public
+ *   License (GPL) as published by the Free Software Foundation; either
+ *   version 3 of the License, or any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ *   Contact : jeremy.fix@centralesupelec.fr
+ *
+ */
+
+#include <fftw3.h>
+#include "convolution_fftw.h"
+
+// Convolution of a 2D array mirrored at its borders, i.e. with reflective
+// (Neumann) boundary conditions, with a kernel symmetric along each axis.
+// The mirrored source is diagonalized by the DCT-II (FFTW_REDFT10) and the
+// symmetric kernel by the DCT-I (FFTW_REDFT00), the result being recovered
+// by the DCT-III (FFTW_REDFT01). All the transforms work on the h_src x w_src
+// field, without any padding.
+namespace DCT_Convolution
+{
+
+  typedef struct Workspace
+  {
+    int h_src, w_src;
+    double * in; // The source and then its transform, multiplied by the kernel spectrum
+    double * spectrum; // The DCT-I of the kernel, with the normalization of the backward transform
+    double * dst; // The result, of size h_src x w_src
+    double * k_in, *k_out; // The (h_src + 1) x (w_src + 1) kernel and its DCT-I
+    fftw_plan p_forw, p_back, p_kernel;
+
+    Workspace();
+  } Workspace;
+
+  void init_workspace(Workspace & ws, int h_src, int w_src,
+		      FFTW_Convolution::Planning_Rigor rigor=FFTW_Convolution::ESTIMATE, int nthreads=1);
+
+  void clear_workspace(Workspace & ws);
+
+  // kernel holds the (h_src + 1) x (w_src + 1) values of the kernel for the
+  // offsets 0 <= i <= h_src and 0 <= j <= w_src, the kernel at (-i, j), (i, -j)
+  // and (-i, -j) being the same. The values beyond h_src or w_src are ignored.
+  // This only needs to be called again when the kernel changes
+  void compute_kernel_spectrum(Workspace & ws, double * kernel);
+
+  // Rescale the DCT coefficients of the kernel by factor : the convolution
+  // is then that of the kernel given to compute_kernel_spectrum times factor
+  void scale_kernel_spectrum(Workspace & ws, double factor);
+
+  // Convolve src with the kernel given to compute_kernel_spectrum
+  // The result is in ws.dst
+  void convolve(Workspace & ws, double * src);
+
+}
@@ -0,0 +1,148 @@
+#include "convolution_direct.hpp"
+
+Direct_Convolution::Workspace::Workspace() {
+  h_src = w_src = 0;
+  h_left = h_right = w_left = w_right = 0;
+  kernel_h = kernel_w = 0;
+  padded = tmp = dst = 0;
+}
+
+void Direct_Convolution::init_workspace(Workspace & ws, FFTW_Convolution::Convolution_Mode mode,
+					int h_src, int w_src,
+					int h_left, int h_right, int w_left, int w_right)
+{
+  if(mode != FFTW_Convolution::CIRCULAR_SAME && mode != FFTW_Convolution::LINEAR_SAME)
+    {
+      printf("Unsupported convolution mode for the direct convolution, possible modes are :\n");
+      printf("   - LINEAR_SAME \n");
+      printf("   - CIRCULAR_SAME \n");
+      return;
+    }
+
+  ws.h_src = h_src;
+  ws.w_src = w_src;
+  ws.mode = mode;
+  ws.h_left = h_left;
+  ws.h_right = h_right;
+  ws.w_left = w_left;
+  ws.w_right = w_right;
+
+  ws.kernel_h = new double[h_left + h_right + 1];
+  ws.kernel_w = new double[w_left + w_right + 1];
+  ws.padded = new double[w_right + w_src + w_left];
+  ws.tmp = new double[h_src * w_src];
+  ws.dst = new double[h_src * w_src];
+}
+
+void Direct_Convolution::clear_workspace(Workspace & ws)
+{
+  delete[] ws.kernel_h;
+  delete[] ws.kernel_w;
+  delete[] ws.padded;
+  delete[] ws.tmp;
+  delete[] ws.dst;
+  ws.kernel_h = ws.kernel_w = 0;
+  ws.padded = ws.tmp = ws.dst = 0;
+}
+
+void Direct_Convolution::set_kernels(Workspace & ws, double * kernel_h, double * kernel_w)
+{
+  // The kernels are stored reversed so that the sliding windows
+  // run forward on the source : dst[j] = sum_u kernel[u] src[j + u - right]
+  std::reverse_copy(kernel_h, kernel_h + ws.h_left + ws.h_right + 1, ws.kernel_h);
+  std::reverse_copy(kernel_w, kernel_w + ws.w_left + ws.w_right + 1, ws.kernel_w);
+}
+
+void Direct_Convolution::scale_kernels(Workspace & ws, double factor)
+{
+  for(double * ptr = ws.kernel_h ; ptr != ws.kernel_h + ws.h_left + ws.h_right + 1 ; ++ptr)
+    *ptr *= factor;
+}
+
+void Direct_Convolution::convolve(Workspace & ws, double * src)
+{
+  int w = ws.w_src;
+  int h = ws.h_src;
+  bool circular = ws.mode == FFTW_Convolution::CIRCULAR_SAME;
+
+  // Convolution along the rows
+  int w_taps = ws.w_left + ws.w_right + 1;
+  for(int i = 0 ; i < h ; ++i)
+    {
+      double * row = src + i * w;
+      double * __restrict__ padded = ws.padded;
+      double * __restrict__ out = ws.tmp + i * w;
+
+      std::copy(row, row + w, padded + ws.w_right);
+      for(int p = 0 ; p < ws.w_right ; ++p)
+	padded[p] = circular ? row[((p - ws.w_right) % w + w) % w] : 0.0;
+      for(int p = 0 ; p < ws.w_left ; ++p)
+	padded[ws.w_right + w + p] = circular ? row[p % w] : 0.0;
+
+      std::fill(out, out + w, 0.0);
+      for(int u = 0 ; u < w_taps ; ++u)
+	FFTW_Convolution::multiply_add(padded + u, ws.kernel_w[u], out, w);
+    }
+
+  // Convolution along the columns, processed row by row
+  // so that the inner loop runs over contiguous memory
+  int h_taps = ws.h_left + ws.h_right + 1;
+  for(int i = 0 ; i < h ; ++i)
+    {
+      double * __restrict__ out = ws.dst + i * w;
+      std::fill(out, out + w, 0.0);
+      for(int u = 0 ; u < h_taps ; ++u)
+	{
+	  int r = i + u - ws.h_right;
+	  if(circular)
+	    r = (r % h + h) % h;
+	  else if(r < 0 || r >= h)
+	    continue;
+
+	  FFTW_Convolution::multiply_add(ws.tmp + r * w, ws.kernel_h[u], out, w);
+	}
+    }
+}
+
+void Direct_Convolution::convolve_sparse(Workspace & ws, const int * indices, const double * values, int n)
+{
+  int w = ws.w_src;
+  int h = ws.h_src;
+  bool circular = ws.mode == FFTW_Convolution::CIRCULAR_SAME;
+
+  std::fill(ws.dst, ws.dst + h * w, 0.0);
+  for(int k = 0 ; k < n ; ++k)
+    {
+      int a = indices[k] / w;
+      int b = indices[k] % w;
+
+      // The source at (a, b) reaches dst[a + o, b + p] with the weight kh(o) kw(p),
+      // kh(o) being ws.kernel_h[h_right - o] and kw(p) ws.kernel_w[w_right - p]
+      // With CIRCULAR_SAME, the columns b - w_left .. b + w_right are wrapped in
+      // at most three contiguous segments, otherwise they are clipped to the field
+      int c_min = b - ws.w_left;
+      int c_max = b + ws.w_right;
+      for(int o = -ws.h_left ; o <= ws.h_right ; ++o)
+	{
+	  int r = a + o;
+	  if(circular)
+	    r = (r % h + h) % h;
+	  else if(r < 0 || r >= h)
+	    continue;
+
+	  double coef = values[k] * ws.kernel_h[ws.h_right - o];
+	  double * __restrict__ out = ws.dst + r * w;
+	  // kw_b[-c] = kw(c - b), c being a column of the unwrapped field
+	  const double * kw_b = ws.kernel_w + ws.w_right + b;
+	  for(int shift = -w ; shift <= w ; shift += w)
+	    {
+	      if(!circular && shift != 0)
+		continue;
+	      int first = std::max(c_min, -shift);
+	      int last = std::min(c_max, w - 1 - shift);
+	      for(int c = first ; c <= last ; ++c)
+		out[c + shift] += coef * kw_b[-c];
+	    }
+	}
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+/*
+ *   Copyright (C) 2016,  CentraleSupelec
+ *
+ *   Author : Jeremy Fix
+ *
+ *   Contributor :
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public
+ *   License (GPL) as published by the Free Software Foundation; either
+ *   version 3 of the License, or any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ *   Contact : jeremy.fix@centralesupelec.fr
+ *
+ */
+
+#include "convolution_fftw.h"
+
+// Direct convolution of a 2D array with a separable kernel of small support
+// k(i,j) = kh(i) kw(j), for -h_left <= i <= h_right and -w_left <= j <= w_right
+// The rows and then the columns are convolved with sliding windows which
+// inner loops run over contiguous memory, with the multiply-add of the widest
+// SIMD instruction set of the processor, \sa FFTW_Convolution::multiply_add
+namespace Direct_Convolution
+{
+
+  typedef struct Workspace
+  {
+    int h_src, w_src;
+    FFTW_Convolution::Convolution_Mode mode;
+    int h_left, h_right, w_left, w_right; // The extent of the kernels around their center
+    double * kernel_h, *kernel_w; // The reversed kernels
+    double * padded; // A row padded with w_right elements before and w_left after
+    double * tmp; // The result of the convolution along the rows
+    double * dst; // The result, of size h_src x w_src
+
+    Workspace();
+  } Workspace;
+
+  // With CIRCULAR_SAME, the field is wrapped and the extents must be smaller than the field
+  // With LINEAR_SAME, the field is padded with zeros
+  void init_workspace(Workspace & ws, FFTW_Convolution::Convolution_Mode mode,
+		      int h_src, int w_src,
+		      int h_left, int h_right, int w_left, int w_right);
+
+  void clear_workspace(Workspace & ws);
+
+  // kernel_h holds the h_left + h_right + 1 values of kh from -h_left to h_right
+  // kernel_w holds the w_left + w_right + 1 values of kw from -w_left to w_right
+  void set_kernels(Workspace & ws, double * kernel_h, double * kernel_w);
+
+  // Multiply the kernels by factor
+  void scale_kernels(Workspace & ws, double factor);
+
+  // Convolve src with the kernels given to set_kernels
+  // The result is in ws.dst
+  void convolve(Workspace & ws, double * src);
+
+  // Convolve the sparse source which n non null values, at the flat positions indices,
+  // are given in values, by scattering the kernels around them. This costs n times
+  // the size of the kernels rather than the size of the field times the size of the kernels
+  // The result is in ws.dst
+  void convolve_sparse(Workspace & ws, const int * indices, const double * values, int n);
+
+}
@@ -1,189 +1,263 @@
 #include "convolution_fftw.h"
 
-int FFTW_FACTORS[7] = {13,11,7,5,3,2,0}; // end with zero to detect the end of the array
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <vector>
 
-void FFTW_Convolution::factorize (const int n,
-				  int *n_factors,
-				  int factors[],
-				  int * implemented_factors)
-{
-  int nf = 0;
-  int ntest = n;
-  int factor;
-  int i = 0;
+static std::string wisdom_filename;
 
-  if (n == 0)
+unsigned int FFTW_Convolution::planner_flags(Planning_Rigor rigor)
+{
+  switch(rigor)
     {
-      printf("Length n must be positive integer\n");
-      return ;
+    case MEASURE:
+      return FFTW_MEASURE;
+    case PATIENT:
+      return FFTW_PATIENT;
+    case EXHAUSTIVE:
+      return FFTW_EXHAUSTIVE;
+    case ESTIMATE:
+    default:
+      return FFTW_ESTIMATE;
     }
+}
 
-  if (n == 1)
-    {
-      factors[0] = 1;
-      *n_factors = 1;
-      return ;
-    }
+void FFTW_Convolution::set_wisdom_filename(const std::string& filename)
+{
+  wisdom_filename = filename;
+  if(wisdom_filename != "")
+    fftw_import_wisdom_from_filename(wisdom_filename.c_str());
+}
 
-  /* deal with the implemented factors */
+void FFTW_Convolution::export_wisdom()
+{
+  if(wisdom_filename != "")
+    fftw_export_wisdom_to_filename(wisdom_filename.c_str());
+}
 
-  while (implemented_factors[i] && ntest != 1)
-    {
-      factor = implemented_factors[i];
-      while ((ntest % factor) == 0)
-	{
-	  ntest = ntest / factor;
-	  factors[nf] = factor;
-	  nf++;
-	}
-      i++;
-    }
+bool FFTW_Convolution::has_threads()
+{
+#ifdef NEURALFIELD_FFTW_THREADS
+  return true;
+#else
+  return false;
+#endif
+}
 
-  // Ok that's it
-  if(ntest != 1)
+// Set the number of threads used by the plans created afterwards
+void FFTW_Convolution::plan_with_nthreads(int nthreads)
+{
+#ifdef NEURALFIELD_FFTW_THREADS
+  static bool threads_initialized = false;
+  if(!threads_initialized)
+    threads_initialized = fftw_init_threads();
+  if(threads_initialized)
+    fftw_plan_with_nthreads(std::max(nthreads, 1));
+#else
+  static bool warned = false;
+  if(nthreads > 1 && !warned)
     {
-      factors[nf] = ntest;
-      nf++;
+      printf("Warning : neuralfield has been built without the multithreaded FFTW, the FFTs will run on a single thread\n");
+      warned = true;
     }
+#endif
+}
 
-  /* check that the factorization is correct */
-  {
-    int product = 1;
+std::recursive_mutex& FFTW_Convolution::planner_mutex()
+{
+  static std::recursive_mutex mutex;
+  return mutex;
+}
 
-    for (i = 0; i < nf; i++)
-      {
-	product *= factors[i];
-      }
+// Whether n = 2^a 3^b 5^c 7^d 11^e 13^f with e+f <= 1
+static bool is_fftw_efficient(int n)
+{
+  for(int factor: {2, 3, 5, 7})
+    while(n % factor == 0)
+      n /= factor;
+  return n == 1 || n == 11 || n == 13;
+}
 
-    if (product != n)
-      {
-	printf("factorization failed");
-      }
+static bool measure_padded_sizes = false;
+static std::string padded_sizes_filename;
+static std::map<int, int> measured_padded_sizes;
+
+// The time, in seconds, of a 1D real to complex transform of size n
+static double time_transform(int n)
+{
+  double * in = (double*) fftw_malloc(sizeof(double) * n);
+  fftw_complex * out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * (n/2+1));
+  fftw_plan p;
+  {
+    std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+    FFTW_Convolution::plan_with_nthreads(1);
+    p = fftw_plan_dft_r2c_1d(n, in, out, FFTW_MEASURE);
   }
+  std::fill(in, in + n, 0.0);
+
+  // The transform is repeated for at least a millisecond
+  int nb_runs = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed;
+  do
+    {
+      fftw_execute(p);
+      ++nb_runs;
+      elapsed = std::chrono::steady_clock::now() - start;
+    }
+  while(elapsed.count() < 1e-3 || nb_runs < 3);
 
-  *n_factors = nf;
+  {
+    std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+    fftw_destroy_plan(p);
+  }
+  fftw_free(in);
+  fftw_free(out);
+  return elapsed.count() / nb_runs;
 }
 
+void FFTW_Convolution::set_padded_size_measurement(bool measure, const std::string& cache_filename)
+{
+  measure_padded_sizes = measure;
+  padded_sizes_filename = cache_filename;
+  if(!measure || cache_filename.empty())
+    return;
+
+  // Each line of the cache holds a size and its padded size
+  std::ifstream infile(cache_filename.c_str());
+  int n, size;
+  while(infile >> n >> size)
+    measured_padded_sizes[n] = size;
+}
 
-bool FFTW_Convolution::is_optimal(int n, int * implemented_factors)
+int FFTW_Convolution::padded_size(int n)
 {
-  // We check that n is not a multiple of 4*4*4*2
-  if(n % 4*4*4*2 == 0)
-    return false;
+  // An empty dimension, e.g. of a 'valid' convolution, is not padded
+  if(n <= 0)
+    return n;
+
+  int size = n;
+  while(!is_fftw_efficient(size))
+    ++size;
 
-  int nf=0;
-  int factors[64];
-  int i = 0;
-  factorize(n, &nf, factors,implemented_factors);
+  if(!measure_padded_sizes || n <= 1)
+    return size;
 
-  // We just have to check if the last factor belongs to GSL_FACTORS
-  while(implemented_factors[i])
+  std::lock_guard<std::recursive_mutex> lock(planner_mutex());
+  auto cached = measured_padded_sizes.find(n);
+  if(cached != measured_padded_sizes.end())
+    return cached->second;
+
+  double best_time = time_transform(size);
+  for(int candidate = size + 1 ; candidate <= 2 * n ; ++candidate)
     {
-      if(factors[nf-1] == implemented_factors[i])
-	return true;
-      ++i;
+      if(!is_fftw_efficient(candidate))
+	continue;
+      double t = time_transform(candidate);
+      if(t < best_time)
+	{
+	  best_time = t;
+	  size = candidate;
+	}
     }
-  return false;
-}
+  measured_padded_sizes[n] = size;
 
-int FFTW_Convolution::find_closest_factor(int n, int * implemented_factor)
-{
-  int j;
-  if(is_optimal(n,implemented_factor))
-    return n;
-  else
+  if(!padded_sizes_filename.empty())
     {
-      j = n+1;
-      while(!is_optimal(j,implemented_factor))
-	++j;
-      return j;
+      std::ofstream outfile(padded_sizes_filename.c_str());
+      for(auto& s: measured_padded_sizes)
+	outfile << s.first << " " << s.second << std::endl;
     }
+  return size;
+}
+
+// The plans of a geometry : channels, rigor, nthreads and the sizes of the transforms
+typedef std::vector<int> Plan_Key;
+typedef std::array<fftw_plan, 3> Cached_Plans; // p_forw_src, p_forw_kernel, p_back
+static std::map<Plan_Key, Cached_Plans> plan_cache;
+
+void FFTW_Convolution::clear_plan_cache()
+{
+  std::lock_guard<std::recursive_mutex> lock(planner_mutex());
+  for(auto& p: plan_cache)
+    for(auto plan: p.second)
+      if(plan)
+	fftw_destroy_plan(plan);
+  plan_cache.clear();
 }
 
 FFTW_Convolution::Workspace::Workspace() {
   in_src = out_src = in_kernel = out_kernel = 0;
   dst_fft = dst = 0;
+  rigor = ESTIMATE;
+  nthreads = 1;
+  channels = 1;
+  rank = 0;
+  owns_scratch = true;
+  spatial_kernel = true;
   p_forw_src = p_forw_kernel = p_back = 0;
 }
 
 
-void FFTW_Convolution::init_workspace(Workspace & ws, Convolution_Mode mode, int h_src, int w_src, int h_kernel, int w_kernel)
+// The size of the transforms and of the result along a dimension
+// of sizes n_src and n_kernel, for the convolution mode
+static bool dimension_sizes(FFTW_Convolution::Convolution_Mode mode, int n_src, int n_kernel, int& n_fftw, int& n_dst)
 {
-  ws.h_src = h_src;
-  ws.w_src = w_src;
-  ws.h_kernel = h_kernel;
-  ws.w_kernel = w_kernel;
-  ws.mode = mode;
-
+  using namespace FFTW_Convolution;
   switch(mode)
     {
     case LINEAR_FULL:
       // Full Linear convolution
-      ws.h_fftw = find_closest_factor(h_src + h_kernel - 1,FFTW_FACTORS);
-      ws.w_fftw = find_closest_factor(w_src + w_kernel - 1,FFTW_FACTORS);
-      ws.h_dst = h_src + h_kernel-1;
-      ws.w_dst = w_src + w_kernel-1;
+      n_fftw = padded_size(n_src + n_kernel - 1);
+      n_dst = n_src + n_kernel-1;
       break;
     case LINEAR_SAME_UNPADDED:
       // Same Linear convolution
-      ws.h_fftw = h_src + int(h_kernel/2.0);
-      ws.w_fftw = w_src + int(w_kernel/2.0);
-      ws.h_dst = h_src;
-      ws.w_dst = w_src;
+      n_fftw = n_src + int(n_kernel/2.0);
+      n_dst = n_src;
       break;
     case LINEAR_SAME:
       // Same Linear convolution
-      ws.h_fftw = find_closest_factor(h_src + int(h_kernel/2.0),FFTW_FACTORS);
-      ws.w_fftw = find_closest_factor(w_src + int(w_kernel/2.0),FFTW_FACTORS);
-      ws.h_dst = h_src;
-      ws.w_dst = w_src;
+      n_fftw = padded_size(n_src + int(n_kernel/2.0));
+      n_dst = n_src;
       break;
     case LINEAR_VALID:
       // Valid Linear convolution
-      if(ws.h_kernel > ws.h_src || ws.w_kernel > ws.w_src)
+      if(n_kernel > n_src)
 	{
 	  //printf("Warning : The 'valid' convolution results in an empty matrix\n");
-	  ws.h_fftw = 0;
-	  ws.w_fftw = 0;
-	  ws.h_dst = 0;
-	  ws.w_dst = 0;
+	  n_fftw = 0;
+	  n_dst = 0;
 	}
       else
 	{
-	  ws.h_fftw = find_closest_factor(h_src, FFTW_FACTORS);
-	  ws.w_fftw = find_closest_factor(w_src, FFTW_FACTORS);
-	  ws.h_dst = h_src - h_kernel+1;
-	  ws.w_dst = w_src - w_kernel+1;
+	  n_fftw = padded_size(n_src);
+	  n_dst = n_src - n_kernel+1;
 	}
       break;
     case CIRCULAR_SAME:
-      ws.h_dst = h_src;
-      ws.w_dst = w_src;
-      ws.h_fftw = ws.h_dst;
-      ws.w_fftw = ws.w_dst;
+      n_dst = n_src;
+      n_fftw = n_dst;
       break;
     case CIRCULAR_SAME_PADDED:
       // Cicular convolution with optimal sizes
-      ws.h_fftw = find_closest_factor(h_src+h_kernel, FFTW_FACTORS);
-      ws.w_fftw = find_closest_factor(w_src+w_kernel, FFTW_FACTORS);
-      ws.h_dst = h_src;
-      ws.w_dst = w_src;
+      n_fftw = padded_size(n_src+n_kernel);
+      n_dst = n_src;
       break;
     case CIRCULAR_FULL_UNPADDED:
       // We here want to compute a circular convolution modulo h_dst, w_dst
       // These two variables must have been set before calling init_workscape !!
-      ws.h_dst = h_src + h_kernel - 1;
-      ws.w_dst = w_src + w_kernel - 1;
-      ws.h_fftw = find_closest_factor(h_src + h_kernel - 1, FFTW_FACTORS);
-      ws.w_fftw = find_closest_factor(w_src + w_kernel - 1, FFTW_FACTORS);
+      n_dst = n_src + n_kernel - 1;
+      n_fftw = padded_size(n_src + n_kernel - 1);
       break;
     case CIRCULAR_FULL:
       // We here want to compute a circular convolution modulo h_dst, w_dst
       // These two variables must have been set before calling init_workscape !!
-      ws.h_dst = h_src + h_kernel - 1;
-      ws.w_dst = w_src + w_kernel - 1;
-      ws.h_fftw = ws.h_dst;
-      ws.w_fftw = ws.w_dst;
+      n_dst = n_src + n_kernel - 1;
+      n_fftw = n_dst;
       break;
     default:
       printf("Unrecognized convolution mode, possible modes are :\n");
@@ -195,148 +269,514 @@ void FFTW_Convolution::init_workspace(Workspace & ws, Convolution_Mode mode, int
       printf("   - CIRCULAR_SAME_PADDED \n");
       printf("   - CIRCULAR_FULL_UNPADDED\n");
       printf("   - CIRCULAR_FULL\n");
+      return false;
     }
+  return true;
+}
+
+void FFTW_Convolution::init_workspace(Workspace & ws, Convolution_Mode mode, int h_src, int w_src, int h_kernel, int w_kernel, Planning_Rigor rigor, int nthreads, int channels, bool spatial_kernel)
+{
+  init_workspace(ws, mode, {h_src, w_src}, {h_kernel, w_kernel}, rigor, nthreads, channels, spatial_kernel);
+}
 
-  ws.in_src = new double[ws.h_fftw * ws.w_fftw];
-  ws.out_src = (double*) fftw_malloc(sizeof(fftw_complex) * ws.h_fftw * (ws.w_fftw/2+1));
-  ws.in_kernel = new double[ws.h_fftw * ws.w_fftw];
-  ws.out_kernel = (double*) fftw_malloc(sizeof(fftw_complex) * ws.h_fftw * (ws.w_fftw/2+1));
+void FFTW_Convolution::init_workspace(Workspace & ws, Convolution_Mode mode, const std::vector<int>& shape_src, const std::vector<int>& shape_kernel, Planning_Rigor rigor, int nthreads, int channels, bool spatial_kernel)
+{
+  assert(shape_src.size() == shape_kernel.size());
+  assert(shape_src.size() >= 1 && int(shape_src.size()) <= MAX_RANK);
 
-  ws.dst_fft = new double[ws.h_fftw * ws.w_fftw];
-  ws.dst = new double[ws.h_dst * ws.w_dst];
+  ws.rank = shape_src.size();
+  ws.mode = mode;
+  ws.rigor = rigor;
+  ws.nthreads = nthreads;
+  ws.channels = channels;
+  ws.owns_scratch = true;
+  ws.spatial_kernel = spatial_kernel;
+
+  bool empty = false;
+  for(int d = 0 ; d < ws.rank ; ++d)
+    {
+      ws.n_src[d] = shape_src[d];
+      ws.n_kernel[d] = shape_kernel[d];
+      if(!dimension_sizes(mode, ws.n_src[d], ws.n_kernel[d], ws.n_fftw[d], ws.n_dst[d]))
+	return;
+      empty |= ws.n_fftw[d] == 0;
+    }
+  // The 'valid' convolution is empty as soon as it is along one dimension
+  if(empty)
+    for(int d = 0 ; d < ws.rank ; ++d)
+      ws.n_fftw[d] = ws.n_dst[d] = 0;
+
+  // The leading dimensions are collapsed in h
+  ws.h_src = ws.h_kernel = ws.h_fftw = ws.h_dst = 1;
+  for(int d = 0 ; d < ws.rank - 1 ; ++d)
+    {
+      ws.h_src *= ws.n_src[d];
+      ws.h_kernel *= ws.n_kernel[d];
+      ws.h_fftw *= ws.n_fftw[d];
+      ws.h_dst *= ws.n_dst[d];
+    }
+  ws.w_src = ws.n_src[ws.rank-1];
+  ws.w_kernel = ws.n_kernel[ws.rank-1];
+  ws.w_fftw = ws.n_fftw[ws.rank-1];
+  ws.w_dst = ws.n_dst[ws.rank-1];
+
+  // All the buffers are allocated with fftw_malloc so that they are aligned
+  // for the SIMD instructions
+  int real_size = ws.h_fftw * ws.w_fftw;
+  int complex_size = ws.h_fftw * (ws.w_fftw/2+1);
+  ws.in_src = (double*) fftw_malloc(sizeof(double) * channels * real_size);
+  ws.out_src = (double*) fftw_malloc(sizeof(fftw_complex) * channels * complex_size);
+  if(spatial_kernel)
+    ws.in_kernel = (double*) fftw_malloc(sizeof(double) * real_size);
+  ws.out_kernel = (double*) fftw_malloc(sizeof(fftw_complex) * complex_size);
+
+  ws.dst_fft = (double*) fftw_malloc(sizeof(double) * channels * real_size);
+  ws.dst = (double*) fftw_malloc(sizeof(double) * channels * ws.h_dst * ws.w_dst);
+
+  // Initialization of the plans, unless this geometry has already been planned
+  // The plans are always executed with the new-array interface, on the buffers
+  // of the workspace, which are aligned as those they have been planned with
+  {
+    // The leading dimensions of size 1, e.g. of a 1D field given as a single row, are dropped
+    int first = 0;
+    while(first < ws.rank - 1 && ws.n_fftw[first] == 1)
+      ++first;
+    int rank = ws.rank - first;
+    int * dims = ws.n_fftw + first;
+
+    Plan_Key key = {channels, rigor, nthreads};
+    key.insert(key.end(), dims, dims + rank);
+
+    std::lock_guard<std::recursive_mutex> lock(planner_mutex());
+    Cached_Plans& plans = plan_cache[key];
+    if(!plans[0])
+      {
+	// Carefull, except with ESTIMATE, planning overwrites the buffers
+	// All the channels are transformed at once
+	unsigned int flags = planner_flags(rigor);
+	plan_with_nthreads(nthreads);
+	plans[0] = fftw_plan_many_dft_r2c(rank, dims, channels,
+					  ws.in_src, NULL, 1, real_size,
+					  (fftw_complex*)ws.out_src, NULL, 1, complex_size,
+					  flags);
+
+	// The backward FFT takes ws.out_src as input !!
+	// ws.out_kernel holds the cached kernel spectrum and must be preserved
+	plans[2] = fftw_plan_many_dft_c2r(rank, dims, channels,
+					  (fftw_complex*)ws.out_src, NULL, 1, complex_size,
+					  ws.dst_fft, NULL, 1, real_size,
+					  flags);
+
+	// Save what has been learned by measuring the plans
+	if(rigor != ESTIMATE)
+	  export_wisdom();
+      }
+    // The kernel plan is only created for the workspaces which transform a spatial kernel
+    if(spatial_kernel && !plans[1])
+      {
+	plan_with_nthreads(nthreads);
+	plans[1] = fftw_plan_dft_r2c(rank, dims, ws.in_kernel, (fftw_complex*)ws.out_kernel, planner_flags(rigor));
+	if(rigor != ESTIMATE)
+	  export_wisdom();
+      }
+    ws.p_forw_src = plans[0];
+    ws.p_forw_kernel = plans[1];
+    ws.p_back = plans[2];
+  }
 
-  // Initialization of the plans
-  ws.p_forw_src = fftw_plan_dft_r2c_2d(ws.h_fftw, ws.w_fftw, ws.in_src, (fftw_complex*)ws.out_src, FFTW_ESTIMATE);
-  ws.p_forw_kernel = fftw_plan_dft_r2c_2d(ws.h_fftw, ws.w_fftw, ws.in_kernel, (fftw_complex*)ws.out_kernel, FFTW_ESTIMATE);
+  // The source always fits in ws.in_src which padding is therefore zeroed once for all,
+  // the forward transforms being out of place, they preserve it
+  std::fill(ws.in_src, ws.in_src + channels * real_size, 0.0);
+}
 
-  // The backward FFT takes ws.out_kernel as input !!
-  ws.p_back = fftw_plan_dft_c2r_2d(ws.h_fftw, ws.w_fftw, (fftw_complex*)ws.out_kernel, ws.dst_fft, FFTW_ESTIMATE);
+// The row of the transformed arrays, of leading dimensions ws.n_fftw, holding the row i
+// of an array of leading dimensions dims, shifted by offsets and wrapped modulo the transforms
+static int fftw_row(const FFTW_Convolution::Workspace & ws, const int * dims, const int * offsets, int i)
+{
+  int row = 0;
+  int stride = 1;
+  for(int d = ws.rank - 2 ; d >= 0 ; --d)
+    {
+      int k = i % dims[d] + (offsets ? offsets[d] : 0);
+      row += (k % ws.n_fftw[d]) * stride;
+      stride *= ws.n_fftw[d];
+      i /= dims[d];
+    }
+  return row;
 }
 
 void FFTW_Convolution::clear_workspace(Workspace & ws)
 {
-  delete[] ws.in_src;
-  fftw_free((fftw_complex*)ws.out_src);    
-  delete[] ws.in_kernel;
+  if(ws.owns_scratch)
+    {
+      fftw_free(ws.in_src);
+      fftw_free((fftw_complex*)ws.out_src);
+      fftw_free(ws.in_kernel);
+      fftw_free(ws.dst_fft);
+      fftw_free(ws.dst);
+    }
   fftw_free((fftw_complex*)ws.out_kernel);
+  ws.owns_scratch = true;
 
-  delete[] ws.dst_fft;
-  delete[] ws.dst;
+  // The plans are owned by the plan cache
 
-  // Destroy the plans
-  fftw_destroy_plan(ws.p_forw_src);
-  fftw_destroy_plan(ws.p_forw_kernel);
-  fftw_destroy_plan(ws.p_back);
+  // The workspace can be safely cleared again
+  ws.in_src = ws.out_src = ws.in_kernel = ws.out_kernel = 0;
+  ws.dst_fft = ws.dst = 0;
+  ws.p_forw_src = ws.p_forw_kernel = ws.p_back = 0;
 }
 
 
-// Compute the circular convolution of src and kernel modulo ws.h_fftw, ws.w_fftw
-// using the Fast Fourier Transform
-// The result is in ws.dst
-void FFTW_Convolution::fftw_circular_convolution(Workspace &ws, double * src, double * kernel)
+FFTW_Convolution::Scratch::Scratch(size_t size): size(size)
 {
-  double * ptr, *ptr_end, *ptr2;
+  data = (double*) fftw_malloc(sizeof(double) * std::max(size, size_t(1)));
+}
 
-  // Reset the content of ws.in_src
-  for(ptr = ws.in_src, ptr_end = ws.in_src + ws.h_fftw*ws.w_fftw ; ptr != ptr_end ; ++ptr)
-    *ptr = 0.0;
-  for(ptr = ws.in_kernel, ptr_end = ws.in_kernel + ws.h_fftw*ws.w_fftw ; ptr != ptr_end ; ++ptr)
+FFTW_Convolution::Scratch::~Scratch()
+{
+  fftw_free(data);
+}
+
+// The sizes of in_src, out_src, in_kernel, dst_fft and dst, in doubles,
+// rounded up to 64 bytes so that the buffers carved in a scratch keep
+// the alignment the plans have been created with
+static std::array<size_t, 5> scratch_sizes(const FFTW_Convolution::Workspace & ws)
+{
+  size_t real_size = ws.h_fftw * ws.w_fftw;
+  size_t complex_size = ws.h_fftw * (ws.w_fftw/2+1);
+  std::array<size_t, 5> sizes = {{ws.channels * real_size,
+				   2 * ws.channels * complex_size,
+				   ws.spatial_kernel ? real_size : 0,
+				   ws.channels * real_size,
+				   size_t(ws.channels * ws.h_dst * ws.w_dst)}};
+  for(auto& s: sizes)
+    s = (s + 7) / 8 * 8;
+  return sizes;
+}
+
+size_t FFTW_Convolution::scratch_size(const Workspace & ws)
+{
+  size_t size = 0;
+  for(auto s: scratch_sizes(ws))
+    size += s;
+  return size;
+}
+
+void FFTW_Convolution::use_scratch(Workspace & ws, Scratch & scratch)
+{
+  auto sizes = scratch_sizes(ws);
+  if(scratch_size(ws) > scratch.size)
+    {
+      printf("The scratch is too small for the workspace, it keeps its own buffers\n");
+      return;
+    }
+
+  if(ws.owns_scratch)
+    {
+      fftw_free(ws.in_src);
+      fftw_free((fftw_complex*)ws.out_src);
+      fftw_free(ws.in_kernel);
+      fftw_free(ws.dst_fft);
+      fftw_free(ws.dst);
+    }
+
+  double * ptr = scratch.data;
+  ws.in_src = ptr;
+  ptr += sizes[0];
+  ws.out_src = ptr;
+  ptr += sizes[1];
+  ws.in_kernel = ws.spatial_kernel ? ptr : 0;
+  ptr += sizes[2];
+  ws.dst_fft = ptr;
+  ptr += sizes[3];
+  ws.dst = ptr;
+  ws.owns_scratch = false;
+}
+
+// Compute the spectrum of the kernel, wrapped modulo ws.h_fftw, ws.w_fftw
+// The normalization of the backward transform is folded into it
+void FFTW_Convolution::compute_kernel_spectrum(Workspace &ws, double * kernel)
+{
+  assert(ws.spatial_kernel);
+
+  double * ptr, *ptr_end;
+  double * in_kernel = ws.in_kernel;
+  if(!in_kernel)
+    in_kernel = (double*) fftw_malloc(sizeof(double) * ws.h_fftw * ws.w_fftw);
+
+  // Reset the content of in_kernel
+  for(ptr = in_kernel, ptr_end = in_kernel + ws.h_fftw*ws.w_fftw ; ptr != ptr_end ; ++ptr)
     *ptr = 0.0;
 
-  // Then we build our periodic signals
-  //ptr = src;
-  for(int i = 0 ; i < ws.h_src ; ++i)
-    for(int j = 0 ; j < ws.w_src ; ++j, ++ptr)
-      ws.in_src[(i%ws.h_fftw)*ws.w_fftw+(j%ws.w_fftw)] += src[i*ws.w_src + j];
-  //ptr = kernel;
+  // Then we build our periodic signal
   for(int i = 0 ; i < ws.h_kernel ; ++i)
-    for(int j = 0 ; j < ws.w_kernel ; ++j, ++ptr)
-      ws.in_kernel[(i%ws.h_fftw)*ws.w_fftw+(j%ws.w_fftw)] += kernel[i*ws.w_kernel + j];
+    {
+      double * row = in_kernel + fftw_row(ws, ws.n_kernel, 0, i) * ws.w_fftw;
+      for(int j = 0 ; j < ws.w_kernel ; ++j)
+	row[j%ws.w_fftw] += kernel[i*ws.w_kernel + j];
+    }
 
-  // And we compute their packed FFT
-  fftw_execute(ws.p_forw_src);
-  fftw_execute(ws.p_forw_kernel);
+  // And we compute its packed FFT
+  fftw_execute_dft_r2c(ws.p_forw_kernel, in_kernel, (fftw_complex*)ws.out_kernel);
+  if(in_kernel != ws.in_kernel)
+    fftw_free(in_kernel);
 
-  // Compute the element-wise product on the packed terms
-  // Let's put the element wise products in ws.in_kernel
-  double re_s, im_s, re_k, im_k;
-  for(ptr = ws.out_src, ptr2 = ws.out_kernel, ptr_end = ws.out_src+2*ws.h_fftw * (ws.w_fftw/2+1); ptr != ptr_end ; ++ptr, ++ptr2)
+  // Scale the spectrum so that the backward FFT needs not be rescaled
+  double scale = 1.0 / double(ws.h_fftw*ws.w_fftw);
+  for(ptr = ws.out_kernel, ptr_end = ws.out_kernel + 2*ws.h_fftw * (ws.w_fftw/2+1) ; ptr != ptr_end ; ++ptr)
+    *ptr *= scale;
+}
+
+// The first n_freq coefficients of the DFT of kernel, of size n_kernel, wrapped modulo n_fftw
+// The real to complex transform gives the coefficients up to n_fftw/2,
+// the others are their conjugates since the kernel is real
+static void line_spectrum(const double * kernel, int n_kernel, int n_fftw, int n_freq,
+			  std::vector<double>& re, std::vector<double>& im)
+{
+  // The empty 'valid' convolution
+  if(n_fftw <= 0)
+    {
+      re.assign(n_freq, 0.0);
+      im.assign(n_freq, 0.0);
+      return;
+    }
+
+  int n_half = n_fftw/2+1;
+  double * wrapped = (double*) fftw_malloc(sizeof(double) * n_fftw);
+  fftw_complex * spectrum = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * n_half);
+  std::fill(wrapped, wrapped + n_fftw, 0.0);
+  for(int i = 0 ; i < n_kernel ; ++i)
+    wrapped[i % n_fftw] += kernel[i];
+
+  // Estimating the plan does not touch the buffers and is cheap enough
+  // for a spectrum which is only computed when the kernel changes
+  fftw_plan p;
+  {
+    std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+    FFTW_Convolution::plan_with_nthreads(1);
+    p = fftw_plan_dft_r2c_1d(n_fftw, wrapped, spectrum, FFTW_ESTIMATE);
+  }
+  fftw_execute(p);
+  {
+    std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+    fftw_destroy_plan(p);
+  }
+
+  re.resize(n_freq);
+  im.resize(n_freq);
+  for(int u = 0 ; u < n_freq ; ++u)
+    {
+      if(u < n_half)
+	{
+	  re[u] = spectrum[u][0];
+	  im[u] = spectrum[u][1];
+	}
+      else
+	{
+	  re[u] = spectrum[n_fftw - u][0];
+	  im[u] = -spectrum[n_fftw - u][1];
+	}
+    }
+  fftw_free(wrapped);
+  fftw_free(spectrum);
+}
+
+void FFTW_Convolution::compute_separable_kernel_spectrum(Workspace &ws, const double * kernel_h, const double * kernel_w)
+{
+  const double * profiles[2] = {kernel_h, kernel_w};
+  compute_separable_kernel_spectrum(ws, profiles);
+}
+
+void FFTW_Convolution::compute_separable_kernel_spectrum(Workspace &ws, const double * const * profiles)
+{
+  // The full spectra along the leading dimensions and the half spectrum along the last one
+  int last = ws.rank - 1;
+  std::vector<std::vector<double> > re(ws.rank), im(ws.rank);
+  for(int d = 0 ; d < ws.rank ; ++d)
+    line_spectrum(profiles[d], ws.n_kernel[d], ws.n_fftw[d], d == last ? ws.n_fftw[d]/2+1 : ws.n_fftw[d], re[d], im[d]);
+
+  // The normalization of the backward transform is folded in, as by compute_kernel_spectrum
+  double scale = 1.0 / double(ws.h_fftw*ws.w_fftw);
+  int w_cplx = ws.w_fftw/2+1;
+  const std::vector<double>& re_w = re[last];
+  const std::vector<double>& im_w = im[last];
+  double * ptr = ws.out_kernel;
+  for(int row = 0 ; row < ws.h_fftw ; ++row)
     {
-      re_s = *ptr;
-      im_s = *(++ptr);
-      re_k = *ptr2;
-      im_k = *(++ptr2);
-      *(ptr2-1) = re_s * re_k - im_s * im_k;
-      *ptr2 = re_s * im_k + im_s * re_k;
+      // The product of the leading spectra at the frequencies of the row
+      double re_u = scale;
+      double im_u = 0.0;
+      for(int d = last - 1, i = row ; d >= 0 ; --d)
+	{
+	  int u = i % ws.n_fftw[d];
+	  i /= ws.n_fftw[d];
+	  double re_t = re_u * re[d][u] - im_u * im[d][u];
+	  im_u = re_u * im[d][u] + im_u * re[d][u];
+	  re_u = re_t;
+	}
+      for(int v = 0 ; v < w_cplx ; ++v)
+	{
+	  *(ptr++) = re_u * re_w[v] - im_u * im_w[v];
+	  *(ptr++) = re_u * im_w[v] + im_u * re_w[v];
+	}
     }
+}
+
+void FFTW_Convolution::scale_kernel_spectrum(Workspace &ws, double factor)
+{
+  double * ptr, *ptr_end;
+  for(ptr = ws.out_kernel, ptr_end = ws.out_kernel + 2*ws.h_fftw * (ws.w_fftw/2+1) ; ptr != ptr_end ; ++ptr)
+    *ptr *= factor;
+}
+
+void FFTW_Convolution::release_kernel_buffers(Workspace &ws)
+{
+  if(!ws.owns_scratch)
+    return;
+
+  fftw_free(ws.in_kernel);
+  fftw_free(ws.dst);
+  ws.in_kernel = ws.dst = 0;
+}
+
+// Copy src in the top left corner of ws.in_src and compute its spectrum in ws.out_src
+void FFTW_Convolution::transform_source(Workspace &ws, double * src)
+{
+  // The source is never larger than the FFT, there is nothing to wrap
+  // and the padding, zeroed by init_workspace, is left untouched
+  // unless the buffer is shared with other workspaces
+  for(int c = 0 ; c < ws.channels ; ++c)
+    {
+      double * in_src = ws.in_src + c * ws.h_fftw * ws.w_fftw;
+      double * src_c = src + c * ws.h_src * ws.w_src;
+      if(ws.rank <= 2)
+	{
+	  for(int i = 0 ; i < ws.h_src ; ++i)
+	    {
+	      memcpy(&in_src[i*ws.w_fftw], &src_c[i*ws.w_src], ws.w_src*sizeof(double));
+	      if(!ws.owns_scratch)
+		std::fill(&in_src[i*ws.w_fftw + ws.w_src], &in_src[(i+1)*ws.w_fftw], 0.0);
+	    }
+	  if(!ws.owns_scratch)
+	    std::fill(&in_src[ws.h_src*ws.w_fftw], &in_src[ws.h_fftw*ws.w_fftw], 0.0);
+	}
+      else
+	{
+	  // The rows are scattered along the leading dimensions
+	  if(!ws.owns_scratch)
+	    std::fill(in_src, in_src + ws.h_fftw*ws.w_fftw, 0.0);
+	  for(int i = 0 ; i < ws.h_src ; ++i)
+	    memcpy(&in_src[fftw_row(ws, ws.n_src, 0, i)*ws.w_fftw], &src_c[i*ws.w_src], ws.w_src*sizeof(double));
+	}
+    }
+
+  // And we compute its packed FFT
+  fftw_execute_dft_r2c(ws.p_forw_src, ws.in_src, (fftw_complex*)ws.out_src);
+}
+
+// Compute the element-wise product of ws.out_src with scale * spectrum
+// product may be ws.out_src itself
+void FFTW_Convolution::spectral_product(Workspace &ws, const double * spectrum, double * product, double scale, bool accumulate)
+{
+  int complex_size = ws.h_fftw * (ws.w_fftw/2+1);
+  for(int c = 0 ; c < ws.channels ; ++c)
+    complex_multiply(ws.out_src + 2*c*complex_size, spectrum, product + 2*c*complex_size, complex_size, scale, accumulate);
+}
+
+// Compute the backward FFT of product into ws.dst_fft
+// product must have been allocated with fftw_malloc as ws.out_src
+void FFTW_Convolution::backward_transform(Workspace &ws, double * product)
+{
+  // Carefull, The backward FFT does not preserve its input
+  fftw_execute_dft_c2r(ws.p_back, (fftw_complex*) product, ws.dst_fft);
+}
+
+// Compute the circular convolution of src with the cached kernel spectrum
+// modulo ws.h_fftw, ws.w_fftw using the Fast Fourier Transform
+// The result is in ws.dst_fft
+void FFTW_Convolution::fftw_circular_convolution(Workspace &ws, double * src)
+{
+  transform_source(ws, src);
+
+  // Compute the element-wise product on the packed terms
+  // Let's put the element wise products in ws.out_src
+  // so that the kernel spectrum is preserved for the next call
+  spectral_product(ws, ws.out_kernel, ws.out_src);
 
   // Compute the backward FFT
-  // Carefull, The backward FFT does not preserve the output
-  fftw_execute(ws.p_back);
-  // Scale the transform
-  for(ptr = ws.dst_fft, ptr_end = ws.dst_fft + ws.w_fftw*ws.h_fftw ; ptr != ptr_end ; ++ptr)
-    *ptr /= double(ws.h_fftw*ws.w_fftw);
+  // The normalization is already folded in the kernel spectrum
+  fftw_execute_dft_c2r(ws.p_back, (fftw_complex*)ws.out_src, ws.dst_fft);
 
   // That's it !
 }
 
+// Compute the circular convolution of src and kernel modulo ws.h_fftw, ws.w_fftw
+// using the Fast Fourier Transform
+// The result is in ws.dst_fft
+void FFTW_Convolution::fftw_circular_convolution(Workspace &ws, double * src, double * kernel)
+{
+  compute_kernel_spectrum(ws, kernel);
+  fftw_circular_convolution(ws, src);
+}
 
 void FFTW_Convolution::convolve(Workspace &ws, double * src,double * kernel)
 {
   if(ws.h_fftw <= 0 || ws.w_fftw <= 0)
     return;
 
-  // Compute the circular convolution
-  fftw_circular_convolution(ws, src, kernel);
+  compute_kernel_spectrum(ws, kernel);
+  convolve(ws, src);
+}
+
+void FFTW_Convolution::convolve(Workspace &ws, double * src)
+{
+  if(ws.h_fftw <= 0 || ws.w_fftw <= 0)
+    return;
+
+  // Compute the circular convolution with the cached kernel spectrum
+  fftw_circular_convolution(ws, src);
+
+  extract_result(ws);
+}
 
-  // Depending on the type of convolution one is looking for, we extract the appropriate part of the result from out_src
-  int h_offset, w_offset;
+void FFTW_Convolution::extract_result(Workspace &ws)
+{
+  scatter_result(ws, ws.dst);
+}
+
+void FFTW_Convolution::scatter_result(Workspace &ws, double * dst, const double * scaling, bool accumulate)
+{
+  // Depending on the type of convolution one is looking for, we extract the appropriate part of the result from dst_fft
+  // The offsets are given along every dimension
+  int offsets[MAX_RANK];
 
   switch(ws.mode)
     {
     case LINEAR_FULL:
       // Full Linear convolution
-      // Here we just keep the first [0:h_dst-1 ; 0:w_dst-1] real part elements of out_src
-      for(int i = 0 ; i < ws.h_dst  ; ++i)
-	memcpy(&ws.dst[i*ws.w_dst], &ws.dst_fft[i*ws.w_fftw], ws.w_dst*sizeof(double));
+      // Here we just keep the first [0:h_dst-1 ; 0:w_dst-1] elements
+      std::fill(offsets, offsets + ws.rank, 0);
       break;
     case LINEAR_SAME_UNPADDED:
     case LINEAR_SAME:
       // Same linear convolution
-      // Here we just keep the first [h_filt/2:h_filt/2+h_dst-1 ; w_filt/2:w_filt/2+w_dst-1] real part elements of out_src
-      h_offset = int(ws.h_kernel/2.0);
-      w_offset = int(ws.w_kernel/2.0);
-      for(int i = 0 ; i < ws.h_dst ; ++i)
-	memcpy(&ws.dst[i*ws.w_dst], &ws.dst_fft[(i+h_offset)*ws.w_fftw+w_offset], ws.w_dst*sizeof(double));
-      //for(int j = 0 ; j < ws.w_dst ; ++j)
-      //   ws.dst[i*ws.w_dst + j] = ws.out_src[2*((i+h_offset)*ws.w_fftw+j+w_offset)+0]/double(ws.w_fftw * ws.h_fftw);
+      // Here we just keep the [h_filt/2:h_filt/2+h_dst-1 ; w_filt/2:w_filt/2+w_dst-1] elements
+      for(int d = 0 ; d < ws.rank ; ++d)
+	offsets[d] = int(ws.n_kernel[d]/2.0);
       break;
-      /*
-	case LINEAR_SAME:
-	// Same linear convolution
-	// Here we just keep the first [h_filt/2:h_filt/2+h_dst-1 ; w_filt/2:w_filt/2+w_dst-1] real part elements of out_src
-	h_offset = int(ws.h_kernel/2.0);
-	w_offset = int(ws.w_kernel/2.0);
-	for(int i = 0 ; i < ws.h_dst ; ++i)
-	memcpy(&ws.dst[i*ws.w_dst], &ws.dst_fft[(i+h_offset)*ws.w_fftw+w_offset], ws.w_dst*sizeof(double));
-	break;
-      */
     case LINEAR_VALID:
       // Valid linear convolution
       // Here we just take [h_dst x w_dst] elements starting at [h_kernel-1;w_kernel-1]
-      h_offset = ws.h_kernel - 1;
-      w_offset = ws.w_kernel - 1;
-      for(int i = 0 ; i < ws.h_dst ; ++i)
-	memcpy(&ws.dst[i*ws.w_dst], &ws.dst_fft[(i+h_offset)*ws.w_fftw+w_offset], ws.w_dst*sizeof(double));
+      for(int d = 0 ; d < ws.rank ; ++d)
+	offsets[d] = ws.n_kernel[d] - 1;
       break;
     case CIRCULAR_SAME:
     case CIRCULAR_FULL:
     case CIRCULAR_SAME_PADDED:
     case CIRCULAR_FULL_UNPADDED:
       // Circular convolution
-      // We copy the first [0:h_dst-1 ; 0:w_dst-1] real part elements of out_src
-      for(int i = 0 ; i < ws.h_dst ; ++i)
-	memcpy(&ws.dst[i*ws.w_dst], &ws.dst_fft[i*ws.w_fftw], ws.w_dst*sizeof(double) );
+      // We copy the first [0:h_dst-1 ; 0:w_dst-1] elements
+      std::fill(offsets, offsets + ws.rank, 0);
       break;
     default:
       printf("Unrecognized convolution mode, possible modes are :\n");
@@ -348,5 +788,31 @@ void FFTW_Convolution::convolve(Workspace &ws, double * src,double * kernel)
       printf("   - CIRCULAR_SAME_PADDED \n");
       printf("   - CIRCULAR_FULL_UNPADDED\n");
       printf("   - CIRCULAR_FULL\n");
+      return;
+    }
+
+  int w_offset = offsets[ws.rank-1];
+  for(int c = 0 ; c < ws.channels ; ++c)
+    {
+      for(int i = 0 ; i < ws.h_dst ; ++i)
+	{
+	  const double * __restrict__ row = &ws.dst_fft[c*ws.h_fftw*ws.w_fftw + fftw_row(ws, ws.n_dst, offsets, i)*ws.w_fftw+w_offset];
+	  double * __restrict__ out = &dst[(c*ws.h_dst + i)*ws.w_dst];
+	  if(!scaling && !accumulate)
+	    memcpy(out, row, ws.w_dst*sizeof(double));
+	  else if(!scaling)
+	    for(int j = 0 ; j < ws.w_dst ; ++j)
+	      out[j] += row[j];
+	  else
+	    {
+	      const double * __restrict__ s = &scaling[i*ws.w_dst];
+	      if(accumulate)
+		for(int j = 0 ; j < ws.w_dst ; ++j)
+		  out[j] += row[j] * s[j];
+	      else
+		for(int j = 0 ; j < ws.w_dst ; ++j)
+		  out[j] = row[j] * s[j];
+	    }
+	}
     }
 }
@@ -5,19 +5,23 @@
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace FFTW_Convolution 
 {
-  // Code adapted from gsl/fft/factorize.c
-  void factorize (const int n,
-		  int *n_factors,
-		  int factors[],
-		  int * implemented_factors);
+  // The size, greater or equal to n, to which a transform of length n is padded.
+  // By default, this is the smallest 2^a 3^b 5^c 7^d 11^e 13^f with e+f <= 1,
+  // the sizes FFTW transforms the most efficiently.
+  // If the measurement is enabled, the transforms of all these sizes between n and 2n
+  // are timed and the fastest one is used
+  int padded_size(int n);
 
-
-
-  bool is_optimal(int n, int * implemented_factors);
-  int find_closest_factor(int n, int * implemented_factor);
+  // Enable or disable the measurement of the padded sizes.
+  // The measured sizes are kept for the process and, if cache_filename is not empty,
+  // saved to and loaded from this file so that they are measured once per machine
+  void set_padded_size_measurement(bool measure, const std::string& cache_filename="");
 
   typedef enum
   {
@@ -31,16 +35,66 @@ namespace FFTW_Convolution
     CIRCULAR_FULL
   } Convolution_Mode;
 
+  // How much time FFTW spends looking for a fast plan
+  // see the FFTW_ESTIMATE, FFTW_MEASURE, ... planner flags
+  typedef enum
+  {
+    ESTIMATE,
+    MEASURE,
+    PATIENT,
+    EXHAUSTIVE
+  } Planning_Rigor;
+
+  unsigned int planner_flags(Planning_Rigor rigor);
+
+  // The wisdom is imported from filename, if it exists,
+  // and exported back to it every time a plan is measured.
+  // Restarting a program with the same file therefore does not
+  // pay the cost of measuring again the plans
+  // An empty filename disables the export
+  void set_wisdom_filename(const std::string& filename);
+  // Export the wisdom to the file given to set_wisdom_filename, if any
+  void export_wisdom();
+
+  // Set the number of threads of the plans created afterwards
+  void plan_with_nthreads(int nthreads);
+
+  // Whether the library has been built with the multithreaded FFTW
+  bool has_threads();
+
+  // The FFTW planner is not thread-safe, every plan of the library
+  // is created while holding this mutex
+  std::recursive_mutex& planner_mutex();
+
+  // The plans of the workspaces are kept in a process-wide cache keyed by
+  // the size of the FFT, the number of channels, the rigor and the number of threads.
+  // A geometry is planned the first time it is met and its plans are then
+  // executed on the buffers of every workspace with the same geometry
+  // Destroy the cached plans ; this must not be called while workspaces are in use
+  void clear_plan_cache();
+
+  // The largest rank of the arrays a workspace convolves
+  const int MAX_RANK = 8;
+
   typedef struct Workspace
   {
     double * in_src, *out_src, *in_kernel, *out_kernel;
+    // The arrays are handled as h x w matrices, w being their last dimension
+    // and h the product of the others, which sizes are given below
     int h_src, w_src, h_kernel, w_kernel;
     int w_fftw, h_fftw;
+    int rank; // The number of dimensions of the arrays
+    int n_src[MAX_RANK], n_kernel[MAX_RANK], n_fftw[MAX_RANK], n_dst[MAX_RANK]; // Their sizes along every dimension
     Convolution_Mode mode;
+    Planning_Rigor rigor;
+    int nthreads; // The number of threads the plans are executed with
+    int channels; // The number of sources, stored one after the other, convolved with the same kernel
+    bool owns_scratch; // Whether in_src, out_src, in_kernel, dst_fft and dst are allocated by the workspace
+    bool spatial_kernel; // Whether the kernel spectrum is transformed from a spatial kernel, in in_kernel
     double * dst_fft;
     double * dst; // The array containing the result
     int h_dst, w_dst; // its size ; This is automatically set by init_workspace
-    fftw_plan p_forw_src;
+    fftw_plan p_forw_src; // The plans, owned by the plan cache
     fftw_plan p_forw_kernel;
     fftw_plan p_back;
 
@@ -48,15 +102,116 @@ namespace FFTW_Convolution
     
   } Workspace;
 
-  void init_workspace(Workspace & ws, Convolution_Mode mode, int h_src, int w_src, int h_kernel, int w_kernel);
+  // With several channels, the sources, the spectra and the results hold
+  // the channels one after the other and are transformed with batched plans
+  // A 1D signal is best given as a single row, h_src = h_kernel = 1 : it is then
+  // transformed with 1D real to complex plans, the spectrum holding w_fftw/2+1 coefficients
+  // Without spatial_kernel, the kernel spectrum is only set by compute_separable_kernel_spectrum
+  // or written directly in ws.out_kernel : in_kernel and p_forw_kernel are then neither
+  // allocated nor planned, and compute_kernel_spectrum must not be called
+  void init_workspace(Workspace & ws, Convolution_Mode mode, int h_src, int w_src, int h_kernel, int w_kernel, Planning_Rigor rigor=ESTIMATE, int nthreads=1, int channels=1, bool spatial_kernel=true);
+
+  // The same for arrays of any rank up to MAX_RANK, transformed with rank-N plans,
+  // the padding of the convolution mode being applied along every dimension
+  void init_workspace(Workspace & ws, Convolution_Mode mode, const std::vector<int>& shape_src, const std::vector<int>& shape_kernel, Planning_Rigor rigor=ESTIMATE, int nthreads=1, int channels=1, bool spatial_kernel=true);
 
   void clear_workspace(Workspace & ws);
 
+  // A block of memory where the workspaces which never convolve at the same time
+  // put their temporary buffers : in_src, out_src, in_kernel, dst_fft and dst.
+  // Only the kernel spectrum, out_kernel, has to persist from one convolution to the other
+  typedef struct Scratch
+  {
+    double * data;
+    size_t size; // in number of doubles
+
+    Scratch(size_t size);
+    ~Scratch();
+    Scratch(const Scratch&) = delete;
+    Scratch& operator=(const Scratch&) = delete;
+  } Scratch;
+
+  // The number of doubles of the temporary buffers of ws, aligned as fftw_malloc does
+  size_t scratch_size(const Workspace & ws);
+
+  // Release the temporary buffers of ws and use scratch, of at least scratch_size(ws), instead.
+  // The padding of the source is then zeroed at every transform since
+  // the other workspaces overwrite it. clear_workspace leaves scratch untouched
+  void use_scratch(Workspace & ws, Scratch & scratch);
+
+  // Compute the spectrum of the kernel, wrapped modulo ws.h_fftw, ws.w_fftw,
+  // and keep it in ws.out_kernel. The 1/(h_fftw*w_fftw) normalization
+  // of the backward transform is folded into this spectrum
+  // This only needs to be called again when the kernel changes
+  // If ws.in_kernel has been released, a temporary buffer is used
+  void compute_kernel_spectrum(Workspace &ws, double * kernel);
+
+  // Free ws.in_kernel and ws.dst, if owned by the workspace.
+  // The callers which only use fftw_circular_convolution and scatter_result
+  // do not need them ; convolve and extract_result then must not be called
+  void release_kernel_buffers(Workspace &ws);
+
+  // Compute the spectrum of the separable kernel k(i,j) = kernel_h[i] kernel_w[j],
+  // of sizes ws.h_kernel and ws.w_kernel, as compute_kernel_spectrum would.
+  // It is the outer product of the 1D spectra of kernel_h and kernel_w, computed
+  // by 1D transforms, which costs O(h_fftw log h_fftw + w_fftw log w_fftw + h_fftw w_fftw)
+  // without any 2D transform
+  void compute_separable_kernel_spectrum(Workspace &ws, const double * kernel_h, const double * kernel_w);
+
+  // The same for a kernel of rank ws.rank, the product of the profiles[d] of sizes ws.n_kernel[d]
+  // Neither the kernel nor its transform are ever built in space
+  void compute_separable_kernel_spectrum(Workspace &ws, const double * const * profiles);
+
+  // Multiply the cached kernel spectrum by factor, as if the spatial kernel had been multiplied by factor,
+  // without transforming it again, e.g. when only the amplitude of a gaussian changes
+  void scale_kernel_spectrum(Workspace &ws, double factor);
+
+  // The steps of a convolution, for the callers which combine several
+  // kernel spectra with the same source
+  // Wrap src and compute its spectrum in ws.out_src
+  void transform_source(Workspace &ws, double * src);
+  // Multiply ws.out_src by scale * spectrum, the result is put in product,
+  // or added to it if accumulate is true, which can be ws.out_src itself.
+  // Every channel is multiplied by the same spectrum
+  void spectral_product(Workspace &ws, const double * spectrum, double * product, double scale=1.0, bool accumulate=false);
+  // Backward transform product into ws.dst_fft ; product must be allocated with fftw_malloc
+  void backward_transform(Workspace &ws, double * product);
+  // Copy the part of ws.dst_fft matching ws.mode into ws.dst
+  void extract_result(Workspace &ws);
+  // Copy the part of ws.dst_fft matching ws.mode into dst, of size channels x h_dst x w_dst,
+  // multiplied element-wise by scaling, of size h_dst x w_dst, if not null,
+  // or add it to dst if accumulate is true
+  void scatter_result(Workspace &ws, double * dst, const double * scaling=0, bool accumulate=false);
+
+  // The element-wise product of n interleaved complex numbers,
+  // product = scale * a * b, or product += scale * a * b if accumulate is true.
+  // product may be a or b. It is vectorized with the widest of the
+  // AVX-512, AVX2 or SSE2 instruction sets supported by the processor
+  void complex_multiply(const double * a, const double * b, double * product, int n, double scale=1.0, bool accumulate=false);
+  // The sum of the n values of x, vectorized as complex_multiply
+  double sum(const double * x, int n);
+  // y += a * x over n values, the step of the sliding windows of Direct_Convolution
+  void multiply_add(const double * x, double a, double * y, int n);
+  // The instruction set used by these kernels : AVX512, AVX2, SSE2 or SCALAR
+  std::string simd_instruction_set();
+  // Force the instruction set used by these kernels, e.g. for benchmarking
+  // Returns false, leaving it unchanged, if the processor does not support it
+  bool set_simd_instruction_set(const std::string& name);
+
+  // Compute the circular convolution of src with the kernel which spectrum
+  // has been cached by compute_kernel_spectrum
+  // The result is in ws.dst_fft
+  void fftw_circular_convolution(Workspace &ws, double * src);
+
   // Compute the circular convolution of src and kernel modulo ws.h_fftw, ws.w_fftw
   // using the Fast Fourier Transform
-  // The result is in ws.dst
+  // The result is in ws.dst_fft
   void fftw_circular_convolution(Workspace &ws, double * src, double * kernel);
 
+  // Convolve src with the cached kernel spectrum
+  // The result is in ws.dst
+  void convolve(Workspace &ws, double * src);
+
   void convolve(Workspace &ws, double * src,double * kernel);
 
 
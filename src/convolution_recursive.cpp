@@ -0,0 +1,245 @@
+#include "convolution_recursive.hpp"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+Recursive_Convolution::Line_Filter::Line_Filter() {
+  n = 0;
+  B = b1 = b2 = b3 = 0.0;
+  std::fill(init, init+9, 0.0);
+}
+
+Recursive_Convolution::Workspace::Workspace() {
+  h_src = w_src = 0;
+  gain = 1.0;
+  state = dst = 0;
+}
+
+// c = a * b for 3x3 matrices
+static void mat_mul(const double * a, const double * b, double * c)
+{
+  for(int i = 0 ; i < 3 ; ++i)
+    for(int j = 0 ; j < 3 ; ++j)
+      {
+	c[3*i+j] = 0.0;
+	for(int k = 0 ; k < 3 ; ++k)
+	  c[3*i+j] += a[3*i+k] * b[3*k+j];
+      }
+}
+
+static void init_line_filter(Recursive_Convolution::Line_Filter & f,
+			     FFTW_Convolution::Convolution_Mode mode,
+			     int n, double sigma)
+{
+  f = Recursive_Convolution::Line_Filter();
+  if(sigma <= 0.0)
+    return;
+  f.n = n;
+
+  // The coefficients of Young and van Vliet are expanded from their poles
+  // m0 and m1 +/- i m2, scaled by q, rather than taken from the polynomials in q
+  // of the paper, whose rounding makes the filters inaccurate for the wide kernels
+  sigma = std::max(sigma, 0.5);
+  double q;
+  if(sigma >= 2.5)
+    q = 0.98711 * sigma - 0.96330;
+  else
+    q = 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+  double m0 = 1.16680, m1 = 1.10783, m2 = 1.40586;
+  double m1sq = m1*m1, m2sq = m2*m2;
+  double scale = (m0 + q) * (m1sq + m2sq + 2.0 * m1 * q + q*q);
+  f.b1 = q * (2.0 * m0 * m1 + m1sq + m2sq + (2.0 * m0 + 4.0 * m1) * q + 3.0 * q*q) / scale;
+  f.b2 = -q*q * (m0 + 2.0 * m1 + 3.0 * q) / scale;
+  f.b3 = q*q*q / scale;
+  // 1 - (b1 + b2 + b3), without the cancellation
+  f.B = m0 * (m1sq + m2sq) / scale;
+
+  if(mode == FFTW_Convolution::CIRCULAR_SAME)
+    {
+      // With the state s = (w[k], w[k-1], w[k-2]), one step of the filter
+      // without input is s <- A s, and a pass over the n elements started from
+      // the state s0 ends in A^n s0 + c where c is the final state when starting from 0.
+      // The periodic steady state is therefore s0 = (I - A^n)^-1 c,
+      // and the same holds for the anti-causal filter
+      double A[9] = {f.b1, f.b2, f.b3,
+		     1.0, 0.0, 0.0,
+		     0.0, 1.0, 0.0};
+      double An[9] = {1.0, 0.0, 0.0,
+		      0.0, 1.0, 0.0,
+		      0.0, 0.0, 1.0};
+      double tmp[9];
+      for(int e = n ; e > 0 ; e >>= 1)
+	{
+	  if(e & 1)
+	    {
+	      mat_mul(An, A, tmp);
+	      std::copy(tmp, tmp+9, An);
+	    }
+	  mat_mul(A, A, tmp);
+	  std::copy(tmp, tmp+9, A);
+	}
+      double m[9];
+      for(int i = 0 ; i < 9 ; ++i)
+	m[i] = (i % 4 == 0 ? 1.0 : 0.0) - An[i];
+      double det = m[0] * (m[4]*m[8] - m[5]*m[7])
+	- m[1] * (m[3]*m[8] - m[5]*m[6])
+	+ m[2] * (m[3]*m[7] - m[4]*m[6]);
+      f.init[0] =  (m[4]*m[8] - m[5]*m[7]) / det;
+      f.init[1] = -(m[1]*m[8] - m[2]*m[7]) / det;
+      f.init[2] =  (m[1]*m[5] - m[2]*m[4]) / det;
+      f.init[3] = -(m[3]*m[8] - m[5]*m[6]) / det;
+      f.init[4] =  (m[0]*m[8] - m[2]*m[6]) / det;
+      f.init[5] = -(m[0]*m[5] - m[2]*m[3]) / det;
+      f.init[6] =  (m[3]*m[7] - m[4]*m[6]) / det;
+      f.init[7] = -(m[0]*m[7] - m[1]*m[6]) / det;
+      f.init[8] =  (m[0]*m[4] - m[1]*m[3]) / det;
+    }
+  else
+    {
+      // Beyond the field, the input is 0 and the causal filter freely decays
+      // from its last state (w[n-1], w[n-2], w[n-3]). The initial state
+      // (y[n], y[n+1], y[n+2]) of the anti-causal filter is linear in this last state,
+      // the columns of the matrix are obtained by filtering the decaying tails
+      for(int c = 0 ; c < 3 ; ++c)
+	{
+	  double s[3] = {0.0, 0.0, 0.0};
+	  s[c] = 1.0;
+	  std::vector<double> tail;
+	  while(tail.size() < 3 || std::max(std::fabs(s[0]), std::max(std::fabs(s[1]), std::fabs(s[2]))) > 1e-17)
+	    {
+	      double w = f.b1 * s[0] + f.b2 * s[1] + f.b3 * s[2];
+	      s[2] = s[1];
+	      s[1] = s[0];
+	      s[0] = w;
+	      tail.push_back(w);
+	    }
+	  double y[3] = {0.0, 0.0, 0.0};
+	  for(int k = int(tail.size()) - 1 ; k >= 0 ; --k)
+	    {
+	      double v = f.B * tail[k] + f.b1 * y[0] + f.b2 * y[1] + f.b3 * y[2];
+	      y[2] = y[1];
+	      y[1] = y[0];
+	      y[0] = v;
+	      if(k < 3)
+		f.init[3*k + c] = v;
+	    }
+	}
+    }
+}
+
+// One step of m filters, s0 holding their last outputs
+static inline void filter_step(const Recursive_Convolution::Line_Filter & f,
+			       const double * __restrict__ in, int m,
+			       double * __restrict__ s0, double * __restrict__ s1, double * __restrict__ s2)
+{
+  for(int j = 0 ; j < m ; ++j)
+    {
+      double v = f.B * in[j] + f.b1 * s0[j] + f.b2 * s1[j] + f.b3 * s2[j];
+      s2[j] = s1[j];
+      s1[j] = s0[j];
+      s0[j] = v;
+    }
+}
+
+static void apply_init(const Recursive_Convolution::Line_Filter & f, int m,
+		       double * s0, double * s1, double * s2)
+{
+  for(int j = 0 ; j < m ; ++j)
+    {
+      double a = s0[j], b = s1[j], c = s2[j];
+      s0[j] = f.init[0] * a + f.init[1] * b + f.init[2] * c;
+      s1[j] = f.init[3] * a + f.init[4] * b + f.init[5] * c;
+      s2[j] = f.init[6] * a + f.init[7] * b + f.init[8] * c;
+    }
+}
+
+// Filter in place m interleaved lines of f.n elements,
+// the element k of the lines being the m contiguous values at data + k * step
+static void filter_lines(const Recursive_Convolution::Line_Filter & f, bool circular,
+			 double * data, int m, int step, double * state)
+{
+  int n = f.n;
+  double * s0 = state;
+  double * s1 = state + m;
+  double * s2 = state + 2*m;
+
+  // Causal filter
+  std::fill(state, state + 3*m, 0.0);
+  if(circular)
+    {
+      for(int k = 0 ; k < n ; ++k)
+	filter_step(f, data + k * step, m, s0, s1, s2);
+      apply_init(f, m, s0, s1, s2);
+    }
+  for(int k = 0 ; k < n ; ++k)
+    {
+      filter_step(f, data + k * step, m, s0, s1, s2);
+      std::copy(s0, s0 + m, data + k * step);
+    }
+
+  // Anti-causal filter
+  if(circular)
+    {
+      std::fill(state, state + 3*m, 0.0);
+      for(int k = n-1 ; k >= 0 ; --k)
+	filter_step(f, data + k * step, m, s0, s1, s2);
+    }
+  // otherwise, the state of the causal filter is (w[n-1], w[n-2], w[n-3])
+  apply_init(f, m, s0, s1, s2);
+  for(int k = n-1 ; k >= 0 ; --k)
+    {
+      filter_step(f, data + k * step, m, s0, s1, s2);
+      std::copy(s0, s0 + m, data + k * step);
+    }
+}
+
+void Recursive_Convolution::init_workspace(Workspace & ws, FFTW_Convolution::Convolution_Mode mode,
+					   int h_src, int w_src,
+					   double sigma_h, double sigma_w, double gain)
+{
+  if(mode != FFTW_Convolution::CIRCULAR_SAME && mode != FFTW_Convolution::LINEAR_SAME)
+    {
+      printf("Unsupported convolution mode for the recursive convolution, possible modes are :\n");
+      printf("   - LINEAR_SAME \n");
+      printf("   - CIRCULAR_SAME \n");
+      return;
+    }
+
+  ws.h_src = h_src;
+  ws.w_src = w_src;
+  ws.mode = mode;
+  ws.gain = gain;
+  init_line_filter(ws.rows, mode, w_src, sigma_w);
+  init_line_filter(ws.cols, mode, h_src, sigma_h);
+
+  ws.state = new double[3 * w_src];
+  ws.dst = new double[h_src * w_src];
+}
+
+void Recursive_Convolution::clear_workspace(Workspace & ws)
+{
+  delete[] ws.state;
+  delete[] ws.dst;
+  ws.state = ws.dst = 0;
+}
+
+void Recursive_Convolution::convolve(Workspace & ws, double * src)
+{
+  int w = ws.w_src;
+  int h = ws.h_src;
+  bool circular = ws.mode == FFTW_Convolution::CIRCULAR_SAME;
+
+  double gain = ws.gain;
+  std::transform(src, src + h * w, ws.dst, [gain](double x) { return gain * x; });
+
+  // Along the rows, one row after the other
+  if(ws.rows.n)
+    for(int i = 0 ; i < h ; ++i)
+      filter_lines(ws.rows, circular, ws.dst + i * w, 1, 1, ws.state);
+
+  // Along the columns, all the columns at once so that
+  // the inner loops run over contiguous memory
+  if(ws.cols.n)
+    filter_lines(ws.cols, circular, ws.dst, w, w, ws.state);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+/*
+ *   Copyright (C) 2016,  CentraleSupelec
+ *
+ *   Author : Jeremy Fix
+ *
+ *   Contributor :
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public
+ *   License (GPL) as published by the Free Software Foundation; either
+ *   version 3 of the License, or any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ *   Contact : jeremy.fix@centralesupelec.fr
+ *
+ */
+
+#include "convolution_fftw.h"
+
+// Gaussian filtering of a 2D array with the recursive approximation of
+// Young and van Vliet (Signal Processing 44, 1995) : along every axis,
+// a third order causal filter followed by the same anti-causal filter.
+// The cost is a few operations per element whatever the standard deviation.
+// With CIRCULAR_SAME, the filters are initialized with their periodic steady state
+// With LINEAR_SAME, the field is padded with zeros, the anti-causal filter being
+// initialized as in Triggs and Sdika (IEEE TSP 54(6), 2006)
+namespace Recursive_Convolution
+{
+
+  // The filter along one axis
+  // w[n] = B x[n] + b1 w[n-1] + b2 w[n-2] + b3 w[n-3]
+  typedef struct Line_Filter
+  {
+    int n; // The number of elements along the axis, 0 if the axis is not filtered
+    double B, b1, b2, b3;
+    double init[9]; // The 3x3 matrix giving the initial state of the filters, row major
+
+    Line_Filter();
+  } Line_Filter;
+
+  typedef struct Workspace
+  {
+    int h_src, w_src;
+    FFTW_Convolution::Convolution_Mode mode;
+    double gain;
+    Line_Filter rows, cols;
+    double * state; // The states of the filters along the columns, 3 x w_src
+    double * dst; // The result, of size h_src x w_src
+
+    Workspace();
+  } Workspace;
+
+  // sigma_h and sigma_w are the standard deviations, in number of cells,
+  // along the columns and the rows. An axis with a standard deviation of 0 is not filtered.
+  // The approximation is valid for standard deviations larger than 0.5 cell
+  // The filtered field is multiplied by gain
+  void init_workspace(Workspace & ws, FFTW_Convolution::Convolution_Mode mode,
+		      int h_src, int w_src,
+		      double sigma_h, double sigma_w, double gain=1.0);
+
+  void clear_workspace(Workspace & ws);
+
+  // Filter src, the result is in ws.dst
+  void convolve(Workspace & ws, double * src);
+
+}
@@ -0,0 +1,260 @@
+#include "convolution_separable.hpp"
+
+#include <cmath>
+
+Separable_Convolution::Line_Workspace::Line_Workspace() {
+  n_src = n_kernel = nb_lines = n_fftw = 0;
+  use_fft = false;
+  kernel = in_kernel = out_kernel = 0;
+  in = out = back = 0;
+  p_forw = p_forw_kernel = p_back = 0;
+}
+
+Separable_Convolution::Workspace::Workspace() {
+  tmp = dst = 0;
+}
+
+static void init_line_workspace(Separable_Convolution::Line_Workspace & lw,
+				FFTW_Convolution::Convolution_Mode mode,
+				int n_src, int n_kernel, int nb_lines, int stride, int dist,
+				unsigned int flags)
+{
+  lw.n_src = n_src;
+  lw.n_kernel = n_kernel;
+  lw.nb_lines = nb_lines;
+  lw.stride = stride;
+  lw.dist = dist;
+
+  if(mode == FFTW_Convolution::CIRCULAR_SAME)
+    {
+      lw.n_fftw = n_src;
+      lw.offset = 0;
+    }
+  else
+    {
+      lw.n_fftw = FFTW_Convolution::padded_size(n_src + int(n_kernel/2.0));
+      lw.offset = int(n_kernel/2.0);
+    }
+
+  // A direct convolution costs n_src multiply-adds per element
+  // while the FFT costs a few n_fftw log(n_fftw) operations per line
+  double direct_cost = double(n_src) * n_src;
+  double fft_cost = 4.0 * lw.n_fftw * std::log2(double(lw.n_fftw)+1.0);
+  lw.use_fft = direct_cost > fft_cost;
+
+  if(mode == FFTW_Convolution::CIRCULAR_SAME)
+    lw.kernel = new double[n_src];
+  else
+    lw.kernel = new double[n_kernel];
+
+  if(lw.use_fft)
+    {
+      int n_cplx = lw.n_fftw/2+1;
+      lw.in = (double*) fftw_malloc(sizeof(double) * nb_lines * lw.n_fftw);
+      lw.out = (double*) fftw_malloc(sizeof(fftw_complex) * nb_lines * n_cplx);
+      lw.back = (double*) fftw_malloc(sizeof(double) * nb_lines * lw.n_fftw);
+      lw.in_kernel = (double*) fftw_malloc(sizeof(double) * lw.n_fftw);
+      lw.out_kernel = (double*) fftw_malloc(sizeof(fftw_complex) * n_cplx);
+
+      // All the lines are transformed with a single batched plan
+      lw.p_forw = fftw_plan_many_dft_r2c(1, &lw.n_fftw, nb_lines,
+					 lw.in, NULL, 1, lw.n_fftw,
+					 (fftw_complex*) lw.out, NULL, 1, n_cplx,
+					 flags);
+      lw.p_back = fftw_plan_many_dft_c2r(1, &lw.n_fftw, nb_lines,
+					 (fftw_complex*) lw.out, NULL, 1, n_cplx,
+					 lw.back, NULL, 1, lw.n_fftw,
+					 flags);
+      lw.p_forw_kernel = fftw_plan_dft_r2c_1d(lw.n_fftw, lw.in_kernel, (fftw_complex*) lw.out_kernel, flags);
+    }
+  else
+    lw.in = new double[n_src];
+}
+
+static void clear_line_workspace(Separable_Convolution::Line_Workspace & lw)
+{
+  delete[] lw.kernel;
+  if(lw.use_fft)
+    {
+      fftw_free(lw.in);
+      fftw_free(lw.out);
+      fftw_free(lw.back);
+      fftw_free(lw.in_kernel);
+      fftw_free(lw.out_kernel);
+      fftw_destroy_plan(lw.p_forw);
+      fftw_destroy_plan(lw.p_back);
+      fftw_destroy_plan(lw.p_forw_kernel);
+    }
+  else
+    delete[] lw.in;
+
+  lw = Separable_Convolution::Line_Workspace();
+}
+
+static void set_line_kernel(Separable_Convolution::Line_Workspace & lw,
+			    FFTW_Convolution::Convolution_Mode mode,
+			    double * kernel)
+{
+  if(mode == FFTW_Convolution::CIRCULAR_SAME)
+    {
+      // The kernel is wrapped modulo the size of the lines
+      std::fill(lw.kernel, lw.kernel + lw.n_src, 0.0);
+      for(int i = 0 ; i < lw.n_kernel ; ++i)
+	lw.kernel[i % lw.n_src] += kernel[i];
+    }
+  else
+    std::copy(kernel, kernel + lw.n_kernel, lw.kernel);
+
+  if(lw.use_fft)
+    {
+      std::fill(lw.in_kernel, lw.in_kernel + lw.n_fftw, 0.0);
+      for(int i = 0 ; i < lw.n_kernel ; ++i)
+	lw.in_kernel[i % lw.n_fftw] += kernel[i];
+      fftw_execute(lw.p_forw_kernel);
+
+      // The normalization of the backward transform is folded in the spectrum
+      double scale = 1.0 / lw.n_fftw;
+      for(double * ptr = lw.out_kernel ; ptr != lw.out_kernel + 2 * (lw.n_fftw/2+1) ; ++ptr)
+	*ptr *= scale;
+    }
+}
+
+static void convolve_lines(Separable_Convolution::Line_Workspace & lw,
+			   FFTW_Convolution::Convolution_Mode mode,
+			   double * src, double * dst)
+{
+  if(lw.use_fft)
+    {
+      // Gather the zero padded lines
+      std::fill(lw.in, lw.in + lw.nb_lines * lw.n_fftw, 0.0);
+      for(int l = 0 ; l < lw.nb_lines ; ++l)
+	{
+	  double * sptr = src + l * lw.dist;
+	  double * iptr = lw.in + l * lw.n_fftw;
+	  for(int j = 0 ; j < lw.n_src ; ++j, sptr += lw.stride)
+	    iptr[j] = *sptr;
+	}
+
+      fftw_execute(lw.p_forw);
+
+      // Multiply every line spectrum by the kernel spectrum
+      int n_cplx = lw.n_fftw/2+1;
+      for(int l = 0 ; l < lw.nb_lines ; ++l)
+	{
+	  double * optr = lw.out + 2 * l * n_cplx;
+	  FFTW_Convolution::complex_multiply(optr, lw.out_kernel, optr, n_cplx);
+	}
+
+      fftw_execute(lw.p_back);
+
+      // Scatter the lines back
+      for(int l = 0 ; l < lw.nb_lines ; ++l)
+	{
+	  double * dptr = dst + l * lw.dist;
+	  double * bptr = lw.back + l * lw.n_fftw;
+	  for(int j = 0 ; j < lw.n_src ; ++j, dptr += lw.stride)
+	    *dptr = bptr[(j + lw.offset) % lw.n_fftw];
+	}
+    }
+  else
+    {
+      int n = lw.n_src;
+      for(int l = 0 ; l < lw.nb_lines ; ++l)
+	{
+	  // Gather the line to work on contiguous memory
+	  double * sptr = src + l * lw.dist;
+	  for(int j = 0 ; j < n ; ++j, sptr += lw.stride)
+	    lw.in[j] = *sptr;
+
+	  double * dptr = dst + l * lw.dist;
+	  for(int j = 0 ; j < n ; ++j, dptr += lw.stride)
+	    {
+	      double sum = 0.0;
+	      if(mode == FFTW_Convolution::CIRCULAR_SAME)
+		{
+		  for(int i = 0 ; i <= j ; ++i)
+		    sum += lw.in[i] * lw.kernel[j - i];
+		  for(int i = j+1 ; i < n ; ++i)
+		    sum += lw.in[i] * lw.kernel[j - i + n];
+		}
+	      else
+		{
+		  // the result j is the element j + offset of the full linear convolution
+		  int jj = j + lw.offset;
+		  int i_min = std::max(0, jj - lw.n_kernel + 1);
+		  int i_max = std::min(n - 1, jj);
+		  for(int i = i_min ; i <= i_max ; ++i)
+		    sum += lw.in[i] * lw.kernel[jj - i];
+		}
+	      *dptr = sum;
+	    }
+	}
+    }
+}
+
+void Separable_Convolution::init_workspace(Workspace & ws, FFTW_Convolution::Convolution_Mode mode,
+					   int h_src, int w_src, int h_kernel, int w_kernel,
+					   FFTW_Convolution::Planning_Rigor rigor, int nthreads)
+{
+  if(mode != FFTW_Convolution::CIRCULAR_SAME && mode != FFTW_Convolution::LINEAR_SAME)
+    {
+      printf("Unsupported convolution mode for the separable convolution, possible modes are :\n");
+      printf("   - LINEAR_SAME \n");
+      printf("   - CIRCULAR_SAME \n");
+      return;
+    }
+
+  ws.h_src = h_src;
+  ws.w_src = w_src;
+  ws.h_kernel = h_kernel;
+  ws.w_kernel = w_kernel;
+  ws.mode = mode;
+
+  unsigned int flags = FFTW_Convolution::planner_flags(rigor);
+  std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+  FFTW_Convolution::plan_with_nthreads(nthreads);
+
+  // The rows are contiguous, the columns are strided by w_src
+  init_line_workspace(ws.rows, mode, w_src, w_kernel, h_src, 1, w_src, flags);
+  init_line_workspace(ws.cols, mode, h_src, h_kernel, w_src, w_src, 1, flags);
+
+  ws.tmp = new double[h_src * w_src];
+  ws.dst = new double[h_src * w_src];
+
+  if(rigor != FFTW_Convolution::ESTIMATE)
+    FFTW_Convolution::export_wisdom();
+}
+
+void Separable_Convolution::clear_workspace(Workspace & ws)
+{
+  std::lock_guard<std::recursive_mutex> lock(FFTW_Convolution::planner_mutex());
+  clear_line_workspace(ws.rows);
+  clear_line_workspace(ws.cols);
+  delete[] ws.tmp;
+  delete[] ws.dst;
+  ws.tmp = ws.dst = 0;
+}
+
+void Separable_Convolution::set_kernels(Workspace & ws, double * kernel_h, double * kernel_w)
+{
+  set_line_kernel(ws.rows, ws.mode, kernel_w);
+  set_line_kernel(ws.cols, ws.mode, kernel_h);
+}
+
+void Separable_Convolution::scale_kernels(Workspace & ws, double factor)
+{
+  // The product of the kernels is scaled through the one along the columns
+  Line_Workspace & lw = ws.cols;
+  int n = ws.mode == FFTW_Convolution::CIRCULAR_SAME ? lw.n_src : lw.n_kernel;
+  for(double * ptr = lw.kernel ; ptr != lw.kernel + n ; ++ptr)
+    *ptr *= factor;
+  if(lw.use_fft)
+    for(double * ptr = lw.out_kernel ; ptr != lw.out_kernel + 2 * (lw.n_fftw/2+1) ; ++ptr)
+      *ptr *= factor;
+}
+
+void Separable_Convolution::convolve(Workspace & ws, double * src)
+{
+  convolve_lines(ws.rows, ws.mode, src, ws.tmp);
+  convolve_lines(ws.cols, ws.mode, ws.tmp, ws.dst);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+ *   Copyright (C) 2016,  CentraleSupelec
+ *
+ *   Author : Jeremy Fix
+ *
+ *   Contributor :
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public
+ *   License (GPL) as published by the Free Software Foundation; either
+ *   version 3 of the License, or any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ *   Contact : jeremy.fix@centralesupelec.fr
+ *
+ */
+
+#include <fftw3.h>
+#include "convolution_fftw.h"
+
+// Convolution of a 2D array with a separable kernel k(i,j) = kh(i) kw(j)
+// performed as a 1D convolution along the rows followed by
+// a 1D convolution along the columns.
+// Each pass is computed either with batched 1D FFTs or directly,
+// depending on which one is the cheapest for the size of the lines
+namespace Separable_Convolution
+{
+
+  // The 1D convolution of a set of lines with the same kernel
+  // The element j of the line l is at l*dist + j*stride
+  typedef struct Line_Workspace
+  {
+    int n_src, n_kernel;
+    int nb_lines;
+    int stride, dist;
+    int n_fftw;
+    int offset; // The index, in the circular convolution, of the first element of the result
+    bool use_fft;
+    double * kernel; // The kernel used by the direct convolution
+    double * in_kernel, *out_kernel; // The kernel and its spectrum used by the FFT convolution
+    double * in, *out, *back;
+    fftw_plan p_forw, p_forw_kernel, p_back;
+
+    Line_Workspace();
+  } Line_Workspace;
+
+  typedef struct Workspace
+  {
+    int h_src, w_src, h_kernel, w_kernel;
+    FFTW_Convolution::Convolution_Mode mode;
+    Line_Workspace rows, cols;
+    double * tmp; // The result of the convolution along the rows
+    double * dst; // The result, of size h_src x w_src
+
+    Workspace();
+  } Workspace;
+
+  // Only the LINEAR_SAME and CIRCULAR_SAME modes are handled
+  void init_workspace(Workspace & ws, FFTW_Convolution::Convolution_Mode mode,
+		      int h_src, int w_src, int h_kernel, int w_kernel,
+		      FFTW_Convolution::Planning_Rigor rigor=FFTW_Convolution::ESTIMATE, int nthreads=1);
+
+  void clear_workspace(Workspace & ws);
+
+  // kernel_h, of size h_kernel, is applied along the columns and
+  // kernel_w, of size w_kernel, along the rows
+  void set_kernels(Workspace & ws, double * kernel_h, double * kernel_w);
+
+  // Multiply the kernels by factor, without transforming them again
+  void scale_kernels(Workspace & ws, double factor);
+
+  // Convolve src with the kernels given to set_kernels
+  // The result is in ws.dst
+  void convolve(Workspace & ws, double * src);
+
+}
@@ -0,0 +1,284 @@
+#include "convolution_fftw.h"
+
+#include <vector>
+
+// The element-wise product of interleaved complex arrays, the sum of an array
+// and the multiply-add of the sliding windows of the direct convolutions,
+// written with the SIMD instructions of the x86 processors and dispatched at runtime
+// to the widest instruction set the processor supports. Every product kernel computes
+// product = scale * a * b, or adds it to product, a and product being allowed to alias
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NEURALFIELD_X86_SIMD
+#include <immintrin.h>
+#endif
+
+typedef void (*Complex_Multiply)(const double *, const double *, double *, int, double, bool);
+typedef double (*Sum)(const double *, int);
+typedef void (*Multiply_Add)(const double *, double, double *, int);
+
+static void complex_multiply_scalar(const double * a, const double * b, double * product, int n, double scale, bool accumulate)
+{
+  double re_a, im_a, re_b, im_b;
+  for(int k = 0 ; k < n ; ++k, a += 2, b += 2, product += 2)
+    {
+      re_a = a[0];
+      im_a = a[1];
+      re_b = b[0];
+      im_b = b[1];
+      double re = scale * (re_a * re_b - im_a * im_b);
+      double im = scale * (re_a * im_b + im_a * re_b);
+      if(accumulate)
+	{
+	  product[0] += re;
+	  product[1] += im;
+	}
+      else
+	{
+	  product[0] = re;
+	  product[1] = im;
+	}
+    }
+}
+
+// Four partial sums, as the SIMD kernels
+static double sum_scalar(const double * x, int n)
+{
+  double partial[4] = {0.0, 0.0, 0.0, 0.0};
+  int k = 0;
+  for( ; k + 4 <= n ; k += 4)
+    for(int l = 0 ; l < 4 ; ++l)
+      partial[l] += x[k + l];
+  for( ; k < n ; ++k)
+    partial[0] += x[k];
+  return (partial[0] + partial[1]) + (partial[2] + partial[3]);
+}
+
+static void multiply_add_scalar(const double * x, double a, double * y, int n)
+{
+  for(int k = 0 ; k < n ; ++k)
+    y[k] += a * x[k];
+}
+
+#ifdef NEURALFIELD_X86_SIMD
+
+// One complex number per register
+// [re_a re_b - im_a im_b, im_a re_b + re_a im_b] = a * re_b + swap(a) * [-im_b, im_b]
+__attribute__((target("sse2")))
+static void complex_multiply_sse2(const double * a, const double * b, double * product, int n, double scale, bool accumulate)
+{
+  const __m128d vscale = _mm_set1_pd(scale);
+  const __m128d sign = _mm_set_pd(1.0, -1.0);
+  for(int k = 0 ; k < n ; ++k, a += 2, b += 2, product += 2)
+    {
+      __m128d va = _mm_loadu_pd(a);
+      __m128d vb = _mm_loadu_pd(b);
+      __m128d re_b = _mm_unpacklo_pd(vb, vb);
+      __m128d im_b = _mm_unpackhi_pd(vb, vb);
+      __m128d swapped = _mm_shuffle_pd(va, va, 1);
+      __m128d res = _mm_add_pd(_mm_mul_pd(va, re_b), _mm_mul_pd(_mm_mul_pd(swapped, im_b), sign));
+      res = _mm_mul_pd(res, vscale);
+      if(accumulate)
+	res = _mm_add_pd(res, _mm_loadu_pd(product));
+      _mm_storeu_pd(product, res);
+    }
+}
+
+// Two complex numbers per register, the subtraction and the addition
+// of the real and imaginary parts being done by fmaddsub
+__attribute__((target("avx2,fma")))
+static void complex_multiply_avx2(const double * a, const double * b, double * product, int n, double scale, bool accumulate)
+{
+  const __m256d vscale = _mm256_set1_pd(scale);
+  int k = 0;
+  for( ; k + 2 <= n ; k += 2, a += 4, b += 4, product += 4)
+    {
+      __m256d va = _mm256_loadu_pd(a);
+      __m256d vb = _mm256_loadu_pd(b);
+      __m256d re_b = _mm256_movedup_pd(vb);
+      __m256d im_b = _mm256_permute_pd(vb, 0xF);
+      __m256d swapped = _mm256_permute_pd(va, 0x5);
+      __m256d res = _mm256_fmaddsub_pd(va, re_b, _mm256_mul_pd(swapped, im_b));
+      res = _mm256_mul_pd(res, vscale);
+      if(accumulate)
+	res = _mm256_add_pd(res, _mm256_loadu_pd(product));
+      _mm256_storeu_pd(product, res);
+    }
+  complex_multiply_scalar(a, b, product, n - k, scale, accumulate);
+}
+
+// Four complex numbers per register
+__attribute__((target("avx512f")))
+static void complex_multiply_avx512(const double * a, const double * b, double * product, int n, double scale, bool accumulate)
+{
+  const __m512d vscale = _mm512_set1_pd(scale);
+  int k = 0;
+  for( ; k + 4 <= n ; k += 4, a += 8, b += 8, product += 8)
+    {
+      __m512d va = _mm512_loadu_pd(a);
+      __m512d vb = _mm512_loadu_pd(b);
+      // The masked forms, with all the lanes selected, do not leave
+      // the undefined register of the unmasked ones to the compiler
+      __m512d re_b = _mm512_mask_movedup_pd(vb, 0xFF, vb);
+      __m512d im_b = _mm512_mask_permute_pd(vb, 0xFF, vb, 0xFF);
+      __m512d swapped = _mm512_mask_permute_pd(va, 0xFF, va, 0x55);
+      __m512d res = _mm512_fmaddsub_pd(va, re_b, _mm512_mul_pd(swapped, im_b));
+      res = _mm512_mul_pd(res, vscale);
+      if(accumulate)
+	res = _mm512_add_pd(res, _mm512_loadu_pd(product));
+      _mm512_storeu_pd(product, res);
+    }
+  complex_multiply_avx2(a, b, product, n - k, scale, accumulate);
+}
+
+// The sums keep two registers of partial sums to hide the latency of the additions
+__attribute__((target("sse2")))
+static double sum_sse2(const double * x, int n)
+{
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  int k = 0;
+  for( ; k + 4 <= n ; k += 4)
+    {
+      s0 = _mm_add_pd(s0, _mm_loadu_pd(x + k));
+      s1 = _mm_add_pd(s1, _mm_loadu_pd(x + k + 2));
+    }
+  double partial[2];
+  _mm_storeu_pd(partial, _mm_add_pd(s0, s1));
+  return partial[0] + partial[1] + sum_scalar(x + k, n - k);
+}
+
+__attribute__((target("avx2")))
+static double sum_avx2(const double * x, int n)
+{
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  int k = 0;
+  for( ; k + 8 <= n ; k += 8)
+    {
+      s0 = _mm256_add_pd(s0, _mm256_loadu_pd(x + k));
+      s1 = _mm256_add_pd(s1, _mm256_loadu_pd(x + k + 4));
+    }
+  double partial[4];
+  _mm256_storeu_pd(partial, _mm256_add_pd(s0, s1));
+  return (partial[0] + partial[1]) + (partial[2] + partial[3]) + sum_scalar(x + k, n - k);
+}
+
+__attribute__((target("avx512f")))
+static double sum_avx512(const double * x, int n)
+{
+  __m512d s0 = _mm512_setzero_pd();
+  __m512d s1 = _mm512_setzero_pd();
+  int k = 0;
+  for( ; k + 16 <= n ; k += 16)
+    {
+      s0 = _mm512_add_pd(s0, _mm512_loadu_pd(x + k));
+      s1 = _mm512_add_pd(s1, _mm512_loadu_pd(x + k + 8));
+    }
+  double partial[8];
+  _mm512_storeu_pd(partial, _mm512_add_pd(s0, s1));
+  return ((partial[0] + partial[1]) + (partial[2] + partial[3]))
+    + ((partial[4] + partial[5]) + (partial[6] + partial[7])) + sum_avx2(x + k, n - k);
+}
+
+__attribute__((target("sse2")))
+static void multiply_add_sse2(const double * x, double a, double * y, int n)
+{
+  const __m128d va = _mm_set1_pd(a);
+  int k = 0;
+  for( ; k + 2 <= n ; k += 2)
+    _mm_storeu_pd(y + k, _mm_add_pd(_mm_loadu_pd(y + k), _mm_mul_pd(va, _mm_loadu_pd(x + k))));
+  multiply_add_scalar(x + k, a, y + k, n - k);
+}
+
+__attribute__((target("avx2,fma")))
+static void multiply_add_avx2(const double * x, double a, double * y, int n)
+{
+  const __m256d va = _mm256_set1_pd(a);
+  int k = 0;
+  for( ; k + 4 <= n ; k += 4)
+    _mm256_storeu_pd(y + k, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + k), _mm256_loadu_pd(y + k)));
+  multiply_add_scalar(x + k, a, y + k, n - k);
+}
+
+__attribute__((target("avx512f")))
+static void multiply_add_avx512(const double * x, double a, double * y, int n)
+{
+  const __m512d va = _mm512_set1_pd(a);
+  int k = 0;
+  for( ; k + 8 <= n ; k += 8)
+    _mm512_storeu_pd(y + k, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + k), _mm512_loadu_pd(y + k)));
+  multiply_add_avx2(x + k, a, y + k, n - k);
+}
+
+#endif
+
+struct Instruction_Set
+{
+  const char * name;
+  Complex_Multiply kernel;
+  Sum sum;
+  Multiply_Add multiply_add;
+  bool supported;
+};
+
+// The instruction sets, from the widest to the scalar fallback
+static std::vector<Instruction_Set> instruction_sets()
+{
+  std::vector<Instruction_Set> sets;
+#ifdef NEURALFIELD_X86_SIMD
+  __builtin_cpu_init();
+  sets.push_back({"AVX512", complex_multiply_avx512, sum_avx512, multiply_add_avx512, bool(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))});
+  sets.push_back({"AVX2", complex_multiply_avx2, sum_avx2, multiply_add_avx2, bool(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))});
+  sets.push_back({"SSE2", complex_multiply_sse2, sum_sse2, multiply_add_sse2, bool(__builtin_cpu_supports("sse2"))});
+#endif
+  sets.push_back({"SCALAR", complex_multiply_scalar, sum_scalar, multiply_add_scalar, true});
+  return sets;
+}
+
+static const Instruction_Set * best_instruction_set()
+{
+  static std::vector<Instruction_Set> sets = instruction_sets();
+  for(auto& s: sets)
+    if(s.supported)
+      return &s;
+  return &sets.back();
+}
+
+static const Instruction_Set *& current_instruction_set()
+{
+  static const Instruction_Set * current = best_instruction_set();
+  return current;
+}
+
+void FFTW_Convolution::complex_multiply(const double * a, const double * b, double * product, int n, double scale, bool accumulate)
+{
+  current_instruction_set()->kernel(a, b, product, n, scale, accumulate);
+}
+
+double FFTW_Convolution::sum(const double * x, int n)
+{
+  return current_instruction_set()->sum(x, n);
+}
+
+void FFTW_Convolution::multiply_add(const double * x, double a, double * y, int n)
+{
+  current_instruction_set()->multiply_add(x, a, y, n);
+}
+
+std::string FFTW_Convolution::simd_instruction_set()
+{
+  return current_instruction_set()->name;
+}
+
+bool FFTW_Convolution::set_simd_instruction_set(const std::string& name)
+{
+  static std::vector<Instruction_Set> sets = instruction_sets();
+  for(auto& s: sets)
+    if(name == s.name && s.supported)
+      {
+	current_instruction_set() = &s;
+	return true;
+      }
+  return false;
+}
@@ -4,8 +4,9 @@
 
 neuralfield::function::Layer::Layer(std::string label,
 				    typename parameters_type::size_type number_of_parameters,
-				    std::vector<int> shape):
-  neuralfield::layer::Layer(label, number_of_parameters, shape) {
+				    std::vector<int> shape,
+				    int channels):
+  neuralfield::layer::Layer(label, number_of_parameters, shape, channels) {
 }
 
 neuralfield::function::Layer::Layer(const neuralfield::function::Layer& other):
@@ -17,6 +18,15 @@ void neuralfield::function::Layer::connect(std::shared_ptr<neuralfield::layer::L
   _prevs.push_back(prev);
 }
 
+const std::list<std::shared_ptr<neuralfield::layer::Layer> >& neuralfield::function::Layer::prevs() const {
+  return _prevs;
+}
+
+void neuralfield::function::Layer::replace_prev(std::shared_ptr<neuralfield::layer::Layer> prev,
+						std::shared_ptr<neuralfield::layer::Layer> new_prev) {
+  std::replace(_prevs.begin(), _prevs.end(), prev, new_prev);
+}
+
 bool neuralfield::function::Layer::is_connected() {
   bool connected = true;
   auto it = _prevs.begin();
@@ -46,8 +56,9 @@ bool neuralfield::function::Layer::can_be_evaluated_from(const std::map<std::sha
 
 neuralfield::function::VectorizedFunction::VectorizedFunction(std::string label,
 							      std::function<double(double)> f,
-							      std::vector<int> shape):
-  neuralfield::function::Layer(label, 0, shape), _f(f) {
+							      std::vector<int> shape,
+							      int channels):
+  neuralfield::function::Layer(label, 0, shape, channels), _f(f) {
 }
 
 void neuralfield::function::VectorizedFunction::update() {
@@ -66,10 +77,17 @@ void neuralfield::function::VectorizedFunction::update() {
 std::shared_ptr<neuralfield::function::Layer> neuralfield::function::function(std::string function_name,
 									      std::vector<int> shape,
 									      std::string label) {
+  return function(function_name, shape, 1, label);
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::function::function(std::string function_name,
+									      std::vector<int> shape,
+									      int channels,
+									      std::string label) {
   std::shared_ptr<neuralfield::function::Layer> l;
   
   if(function_name == "sigmoid") {
-    l = std::make_shared<neuralfield::function::VectorizedFunction>(label, [](double x) -> double { return 1.0 / (1.0 + exp(-x));}, shape);
+    l = std::make_shared<neuralfield::function::VectorizedFunction>(label, [](double x) -> double { return 1.0 / (1.0 + exp(-x));}, shape, channels);
   }
   else if(function_name == "relu") {
     l = std::make_shared<neuralfield::function::VectorizedFunction>(label, [](double x) -> double {
@@ -77,7 +95,7 @@ std::shared_ptr<neuralfield::function::Layer> neuralfield::function::function(st
 	  return 0.0;
 	else
 	  return x;
-      }, shape);
+      }, shape, channels);
   }
   else {
     throw std::invalid_argument(std::string("Unknown function : ") + function_name);
@@ -106,8 +124,9 @@ std::shared_ptr<neuralfield::function::Layer> neuralfield::function::function(st
 
 
 neuralfield::function::Constant::Constant(std::string label,
-					  std::vector<int> shape):
-  neuralfield::function::Layer(label, 1, shape) {
+					  std::vector<int> shape,
+					  int channels):
+  neuralfield::function::Layer(label, 1, shape, channels) {
 
 }
 
@@ -126,7 +145,14 @@ void neuralfield::function::Constant::set_parameters(std::vector<double> params)
 std::shared_ptr<neuralfield::function::Layer> neuralfield::function::constant(double value,
 						       std::vector<int> shape,
 						       std::string label) {
-  auto l = std::make_shared<neuralfield::function::Constant>(neuralfield::function::Constant(label, shape));
+  return neuralfield::function::constant(value, shape, 1, label);
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::function::constant(double value,
+						       std::vector<int> shape,
+						       int channels,
+						       std::string label) {
+  auto l = std::make_shared<neuralfield::function::Constant>(neuralfield::function::Constant(label, shape, channels));
   l->set_parameters({value});
   auto net = neuralfield::get_current_network();
   net += l;
@@ -151,8 +177,9 @@ std::shared_ptr<neuralfield::function::Layer> neuralfield::function::constant(do
 
 neuralfield::function::UniformNoise::UniformNoise(std::string label,
 						  std::vector<int> shape,
-						  double min, double max):
-  neuralfield::function::Layer(label, 0, shape),
+						  double min, double max,
+						  int channels):
+  neuralfield::function::Layer(label, 0, shape, channels),
   _min(min), _max(max) {
   for(auto& v: _values)
     v = neuralfield::random::uniform(_min, _max);
@@ -164,7 +191,13 @@ void neuralfield::function::UniformNoise::update() {
 
 std::shared_ptr<neuralfield::function::Layer> neuralfield::function::uniform_noise(double min, double max, std::vector<int> shape,
 										   std::string label) {
-  auto l = std::make_shared<neuralfield::function::UniformNoise>(neuralfield::function::UniformNoise(label, shape, min, max));
+  return neuralfield::function::uniform_noise(min, max, shape, 1, label);
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::function::uniform_noise(double min, double max, std::vector<int> shape,
+										   int channels,
+										   std::string label) {
+  auto l = std::make_shared<neuralfield::function::UniformNoise>(neuralfield::function::UniformNoise(label, shape, min, max, channels));
   auto net = neuralfield::get_current_network();
   net += l;
   return l;
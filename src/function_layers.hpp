@@ -43,11 +43,15 @@ namespace neuralfield {
     public:
       Layer(std::string label,
 		    typename parameters_type::size_type number_of_parameters,
-		    std::vector<int> shape);
+		    std::vector<int> shape,
+		    int channels=1);
 
       Layer(const Layer& other);
 
       void connect(std::shared_ptr<neuralfield::layer::Layer> prev);
+      const std::list<std::shared_ptr<neuralfield::layer::Layer> >& prevs() const;
+      void replace_prev(std::shared_ptr<neuralfield::layer::Layer> prev,
+			std::shared_ptr<neuralfield::layer::Layer> new_prev);
       bool is_connected();
       void update(void) override;
       bool can_be_evaluated_from(const std::map<std::shared_ptr<neuralfield::layer::Layer>, bool>& evaluation_status);
@@ -59,7 +63,8 @@ namespace neuralfield {
     public:
       VectorizedFunction(std::string label,
 			 std::function<double(double)> f,
-			 std::vector<int> shape);
+			 std::vector<int> shape,
+			 int channels=1);
 
       void update() override;
     };
@@ -68,6 +73,11 @@ namespace neuralfield {
 								std::vector<int> shape,
 								std::string label="");
 
+    std::shared_ptr<neuralfield::function::Layer> function(std::string function_name,
+								std::vector<int> shape,
+								int channels,
+								std::string label="");
+
     std::shared_ptr<neuralfield::function::Layer> function(std::string function_name,
 								int size,
 								std::string label="");
@@ -80,7 +90,8 @@ namespace neuralfield {
     class Constant : public neuralfield::function::Layer {
     public:
       Constant(std::string label,
-	       std::vector<int> shape);
+	       std::vector<int> shape,
+	       int channels=1);
       void update() override;
       void set_parameters(std::vector<double> params) override;
       
@@ -90,6 +101,11 @@ namespace neuralfield {
 							   std::vector<int> shape,
 							   std::string label="");
 
+    std::shared_ptr<neuralfield::function::Layer> constant(double value,
+							   std::vector<int> shape,
+							   int channels,
+							   std::string label="");
+
     std::shared_ptr<neuralfield::function::Layer> constant(double value,
 							   int size,
 							   std::string label="");
@@ -106,7 +122,8 @@ namespace neuralfield {
     public:
       UniformNoise(std::string label,
 	       std::vector<int> shape,
-	       double min, double max );
+	       double min, double max,
+	       int channels=1);
       void update() override;
       
     };
@@ -115,6 +132,11 @@ namespace neuralfield {
 								std::vector<int> shape,
 								std::string label="");
 
+    std::shared_ptr<neuralfield::function::Layer> uniform_noise(double min, double max,
+								std::vector<int> shape,
+								int channels,
+								std::string label="");
+
     std::shared_ptr<neuralfield::function::Layer> uniform_noise(double min, double max,
 								int size,
 								std::string label="");
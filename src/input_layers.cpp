@@ -2,8 +2,9 @@
 
 neuralfield::input::AbstractLayer::AbstractLayer(std::string label,
 						 typename parameters_type::size_type number_of_parameters,
-						 std::vector<int> shape):
-  neuralfield::layer::Layer(label, number_of_parameters, shape) {
+						 std::vector<int> shape,
+						 int channels):
+  neuralfield::layer::Layer(label, number_of_parameters, shape, channels) {
 }
 
 
@@ -45,7 +45,8 @@ namespace neuralfield {
     public:
       AbstractLayer(std::string label,
 			 typename parameters_type::size_type number_of_parameters,
-			 std::vector<int> shape);
+			 std::vector<int> shape,
+			 int channels=1);
 
       void update(void) override;
       
@@ -71,8 +72,9 @@ namespace neuralfield {
       Layer(std::string label,
 	    typename parameters_type::size_type number_of_parameters,
 	    std::vector<int> shape,
-	    fill_input_type fill_input) :
-	AbstractLayer(label, number_of_parameters, shape),
+	    fill_input_type fill_input,
+	    int channels=1) :
+	AbstractLayer(label, number_of_parameters, shape, channels),
 	_fill_input(fill_input) {}
       
       void fill(const input_type& input) {
@@ -89,6 +91,15 @@ namespace neuralfield {
       return l;
     }
     
+    // Multi-channel input, the fill function is given all the channels one after the other
+    template<typename INPUT>
+    std::shared_ptr<AbstractLayer> input(std::vector<int> shape, int channels, typename Layer<INPUT>::fill_input_type fill_input, std::string label="") {
+      auto l = std::make_shared<Layer<INPUT> >(Layer<INPUT>(label, 0, shape, fill_input, channels));
+      auto net = neuralfield::get_current_network();
+      net += l;
+      return l;
+    }
+
     // Utilitary function for building up 1D Layer
     template<typename INPUT>
     std::shared_ptr<AbstractLayer> input(int size, typename Layer<INPUT>::fill_input_type fill_input, std::string label="") {
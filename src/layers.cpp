@@ -5,12 +5,14 @@
 
 neuralfield::layer::Layer::Layer(std::string label,
 				 typename neuralfield::parameters_type::size_type number_of_parameters,
-				 std::vector<int> shape):
+				 std::vector<int> shape,
+				 int channels):
   _label(label),
   _parameters(number_of_parameters),
-  _shape(shape) {
+  _shape(shape),
+  _channels(channels) {
 
-  _size = 1;       
+  _size = channels;       
   for(auto s: _shape)
     _size *= s;
   
@@ -27,6 +29,10 @@ unsigned int neuralfield::layer::Layer::size() const {
 std::vector<int> neuralfield::layer::Layer::shape() const {
   return _shape;
 }
+
+int neuralfield::layer::Layer::channels() const {
+  return _channels;
+}
       
 std::string neuralfield::layer::Layer::label() {
   return _label;
@@ -60,19 +60,24 @@ namespace neuralfield {
       std::string _label;
       parameters_type _parameters;
       std::vector<int> _shape;
+      int _channels; // The number of values at every position of the field
       values_type::size_type _size;
       values_type _values;
     public:
       Layer() = delete;
       
+      // The values of the channels are stored one after the other,
+      // the channel c of the position i being at c * prod(shape) + i
       Layer(std::string label,
 	    typename parameters_type::size_type number_of_parameters,
-	    std::vector<int> shape);
+	    std::vector<int> shape,
+	    int channels=1);
       
       Layer(const Layer&) = default;
 
       unsigned int size() const;
       std::vector<int> shape() const;
+      int channels() const;
       std::string label();
       
       virtual void set_parameters(std::vector<double> params);
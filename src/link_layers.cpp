@@ -1,12 +1,83 @@
 #include "link_layers.hpp"
 #include "network.hpp"
 #include "tools.hpp"
+#include <chrono>
+#include <numeric>
 
-void neuralfield::link::Gaussian::init_convolution() {
+// exp(-d^2/(2s^2)) for the offsets first, first+1, ..., last from the center
+// of a kernel of size k_shape, d being normalized as for the full kernel
+static void gaussian_profile(int k_shape, bool toric, double s, int first, int last, double * profile) {
+    const std::vector<double>& d2 = neuralfield::distances::squared_distances_1D(k_shape, toric);
+    double c = -1.0 / (2.0 * s*s);
+    for(int i = first ; i <= last ; ++i, ++profile)
+        *profile = exp(c * d2[i + k_shape - 1]);
+}
+
+// The factors scaling the weights of a non toric kernel at every position of the field
+// of the given shape, for every position to see the same sum of weights than the center.
+// The sums of a separable kernel over boxes are the products of 1D sums, the factor
+// along every axis is computed from the cumulative sums of the profile
+static void separable_scaling_factors(const std::vector<int>& shape, double s, double * scaling_factors) {
+    std::vector<std::vector<double> > factors(shape.size());
+    for(unsigned int d = 0 ; d < shape.size() ; ++d) {
+        int n = shape[d];
+        int k_shape = 2*n-1;
+        std::vector<double> profile(k_shape);
+        gaussian_profile(k_shape, false, s, -(k_shape/2), k_shape-1-k_shape/2, profile.data());
+        std::vector<double> cumsum(k_shape+1, 0.0);
+        for(int i = 0 ; i < k_shape ; ++i)
+            cumsum[i+1] = cumsum[i] + profile[i];
+        double max_sum_weights = cumsum[(n-1)/2 + n] - cumsum[(n-1)/2];
+        factors[d].resize(n);
+        for(int i = 0 ; i < n ; ++i)
+            factors[d][i] = max_sum_weights / (cumsum[i+n] - cumsum[i]);
+    }
+    int size = std::accumulate(shape.begin(), shape.end(), 1, std::multiplies<int>());
+    for(int k = 0 ; k < size ; ++k) {
+        double factor = 1.0;
+        for(int d = shape.size() - 1, i = k ; d >= 0 ; --d) {
+            factor *= factors[d][i % shape[d]];
+            i /= shape[d];
+        }
+        scaling_factors[k] = factor;
+    }
+}
+
+// The spectrum of the gaussian kernel of shape k_shape in ws.out_kernel, the product of
+// the spectra of its profiles, the amplitude and the normalization being put in the first one
+static void separable_kernel_spectrum(FFTW_Convolution::Workspace & ws, const std::vector<int>& k_shape, bool toric, double A, double s) {
+    std::vector<std::vector<double> > profiles(k_shape.size());
+    std::vector<const double*> profile_ptrs;
+    double normalization = 1.0;
+    for(unsigned int d = 0 ; d < k_shape.size() ; ++d) {
+        int c = toric ? 0 : k_shape[d]/2;
+        profiles[d].resize(k_shape[d]);
+        gaussian_profile(k_shape[d], toric, s, -c, k_shape[d]-1-c, profiles[d].data());
+        profile_ptrs.push_back(profiles[d].data());
+        normalization /= k_shape[d];
+    }
+    for(auto& k: profiles[0])
+        k *= A * normalization;
+    FFTW_Convolution::compute_separable_kernel_spectrum(ws, profile_ptrs.data());
+}
+
+void neuralfield::link::Gaussian::clear_engines() {
     FFTW_Convolution::clear_workspace(ws);
+    Separable_Convolution::clear_workspace(sws);
+    Direct_Convolution::clear_workspace(dws);
+    Recursive_Convolution::clear_workspace(rws);
+    DCT_Convolution::clear_workspace(cws);
+    Direct_Convolution::clear_workspace(sdws);
+    _scratch.reset();
+}
+
+void neuralfield::link::Gaussian::release_buffers() {
     delete[] kernel;
     kernel = 0;
+    FFTW_Convolution::release_kernel_buffers(ws);
+}
 
+void neuralfield::link::Gaussian::init_convolution() {
     if(_shape.size() == 1) {
         int k_shape;
         int k_center;
@@ -14,104 +85,271 @@ void neuralfield::link::Gaussian::init_convolution() {
         if(_toric) {
             k_shape = _shape[0];
             k_center = 0;
-            FFTW_Convolution::init_workspace(ws, FFTW_Convolution::CIRCULAR_SAME, _shape[0], 1, k_shape, 1);
-
         }
         else {
             k_shape = 2*_shape[0]-1;
             k_center = k_shape/2;
-            FFTW_Convolution::init_workspace(ws, FFTW_Convolution::LINEAR_SAME,  _shape[0], 1, k_shape, 1);
-
         }
 
-        auto dist = neuralfield::distances::make_euclidean_1D({k_shape,}, _toric);
-
-        kernel = new double[k_shape];
-        double * kptr = kernel;
+        if(!kernel)
+            kernel = new double[k_shape];
         double A = _parameters[0];
         double s = _parameters[1];
-        for(int i = 0 ; i < k_shape ; ++i, ++kptr) {
-            float d = dist(i, k_center);
-            *kptr = A * exp(-d*d / (2.0 * s*s))  * 1.0 / (k_shape);
-        }
+        gaussian_profile(k_shape, _toric, s, -k_center, k_shape-1-k_center, kernel);
+        for(int i = 0 ; i < k_shape ; ++i)
+            kernel[i] *= A / k_shape;
 
         /// Scaling of the weights
         // This is usefull to prevent border effects when the connections are not toric
-        if(_toric || !_scale) 
+        if(_toric || _reflective || !_scale) 
             std::fill(_scaling_factors, _scaling_factors + _size, 1.);
         else {
-            double max_sum_weights = 0.0;
-            kptr = kernel + int((_shape[0]-1.)/2.);
-            for(int i = 0 ; i < _shape[0] ; ++i, ++kptr)
-                max_sum_weights += *kptr;
-
-            for(int i = 0 ; i < _shape[0]; ++i) {
-                double sum_weights = 0.0;
-                kptr = kernel + i;
-                for(int j = 0 ; j < _shape[0]; ++j, ++kptr)
-                    sum_weights += *kptr;
-
-                _scaling_factors[i] = max_sum_weights / sum_weights;	
-            }
-        }
+            // The sum of the weights seen from the position i is the sum of the kernel
+            // over [i, i+N-1], computed from the cumulative sums of the kernel
+            std::vector<double> cumsum(k_shape+1, 0.0);
+            for(int i = 0 ; i < k_shape ; ++i)
+                cumsum[i+1] = cumsum[i] + kernel[i];
+            auto sum_weights = [&cumsum, this](int i) {
+                return cumsum[i+_shape[0]] - cumsum[i];
+            };
 
+            double max_sum_weights = sum_weights(int((_shape[0]-1.)/2.));
+            for(int i = 0 ; i < _shape[0]; ++i)
+                _scaling_factors[i] = max_sum_weights / sum_weights(i);
+        }
 
+        init_engine({k_shape});
     }
     else if(_shape.size() == 2) {
         std::array<int, 2> k_shape;
-        std::array<double, 2> k_center;
+        std::array<int, 2> k_center;
         if(_toric) {
             k_shape[0] = _shape[0];
             k_shape[1] = _shape[1];
-            k_center[0] = 0.;
-            k_center[1] = 0.;
-            FFTW_Convolution::init_workspace(ws, FFTW_Convolution::CIRCULAR_SAME, _shape[0], _shape[1], k_shape[0], k_shape[1]);
+            k_center[0] = 0;
+            k_center[1] = 0;
         }
         else {
             k_shape[0] = 2*_shape[0]-1;
             k_shape[1] = 2*_shape[1]-1;
             k_center[0] = k_shape[0]/2;
             k_center[1] = k_shape[1]/2;
-            FFTW_Convolution::init_workspace(ws, FFTW_Convolution::LINEAR_SAME,  _shape[0], _shape[1], k_shape[0], k_shape[1]);
         }
 
-        auto dist = neuralfield::distances::make_euclidean_2D(k_shape, _toric);
-
-        kernel = new double[k_shape[0]*k_shape[1]];
-        double A = _parameters[0];
-        double s = _parameters[1];
-        double * kptr = kernel;
-        for(int i = 0 ; i < k_shape[0] ; ++i) {
-            for(int j = 0 ; j < k_shape[1]; ++j, ++kptr) {
-                float d = dist({(double)i, (double)j}, k_center);
-                *kptr = A * exp(-d*d / (2.0 * s*s)) * 1.0 / (k_shape[0] * k_shape[1]);
+        // exp(-(dx^2+dy^2)/(2s^2)) = exp(-dx^2/(2s^2)) exp(-dy^2/(2s^2)), the kernel is
+        // the outer product of the profiles along the columns and along the rows
+        // the amplitude and normalization being put in the profile along the columns
+        // A toric kernel is never needed in space, the FFT engine builds its spectrum
+        // from the profiles and the other engines work with the profiles
+        if(!_toric) {
+            if(!kernel)
+                kernel = new double[k_shape[0]*k_shape[1]];
+            double A = _parameters[0];
+            double s = _parameters[1];
+            std::vector<double> profile_h(k_shape[0]);
+            std::vector<double> profile_w(k_shape[1]);
+            gaussian_profile(k_shape[0], _toric, s, -k_center[0], k_shape[0]-1-k_center[0], profile_h.data());
+            gaussian_profile(k_shape[1], _toric, s, -k_center[1], k_shape[1]-1-k_center[1], profile_w.data());
+            double * kptr = kernel;
+            for(int i = 0 ; i < k_shape[0] ; ++i) {
+                double kh = A * profile_h[i] / (k_shape[0] * k_shape[1]);
+                for(int j = 0 ; j < k_shape[1]; ++j, ++kptr)
+                    *kptr = kh * profile_w[j];
             }
         }
 
         /// Scaling of the weights
         // This might be usefull to prevent border effects when the connections are not toric
-        if(_toric || !_scale) 
+        if(_toric || _reflective || !_scale) 
             std::fill(_scaling_factors, _scaling_factors + _size, 1.);
         else {
-            double max_sum_weights = 0.0;
-
-            for(int i = 0 ; i < _shape[1]; ++i) // do not use kptr, we skip some values..
-                for(int j = 0 ; j < _shape[0] ; ++j)
-                    max_sum_weights += kernel[(i+int((_shape[1]-1.)/2.))*k_shape[0] + (j+int((_shape[0]-1.)/2.))];
-
-            for(int i = 0 ; i < _shape[1]; ++i) // do not use kptr, we skip some values..
-                for(int j = 0 ; j < _shape[0] ; ++j) {
-                    double sum_weights = 0.0;
-                    for(int k = 0 ; k < _shape[1]; ++k) 
-                        for(int l = 0 ; l < _shape[0]; ++l) 
-                            sum_weights += kernel[(k+i) * k_shape[0] + (l+j)];
-                    _scaling_factors[i*_shape[0] + j] = max_sum_weights / sum_weights;
+            // The sum of the weights seen from the position (i, j) is the sum of the kernel
+            // over [i, i+H-1] x [j, j+W-1], computed from the summed-area table of the kernel
+            int w_table = k_shape[1]+1;
+            std::vector<double> table((k_shape[0]+1) * w_table, 0.0);
+            for(int i = 0 ; i < k_shape[0] ; ++i) {
+                double row_sum = 0.0;
+                for(int j = 0 ; j < k_shape[1] ; ++j) {
+                    row_sum += kernel[i*k_shape[1] + j];
+                    table[(i+1)*w_table + j+1] = table[i*w_table + j+1] + row_sum;
                 }
+            }
+            int h = _shape[0];
+            int w = _shape[1];
+            auto sum_weights = [&table, w_table, h, w](int i, int j) {
+                return table[(i+h)*w_table + j+w] - table[i*w_table + j+w]
+                    - table[(i+h)*w_table + j] + table[i*w_table + j];
+            };
+
+            double max_sum_weights = sum_weights(int((h-1.)/2.), int((w-1.)/2.));
+            for(int i = 0 ; i < h; ++i)
+                for(int j = 0 ; j < w ; ++j)
+                    _scaling_factors[i*w + j] = max_sum_weights / sum_weights(i, j);
         }
 
+        init_engine({k_shape[0], k_shape[1]});
+    }
+    else {
+        // In higher dimensions, the kernel is the outer product of the profiles along
+        // every axis. It is never built in space : the FFT engine builds its spectrum
+        // from the profiles and the sums of the weights seen from every position,
+        // the sums of a separable kernel over boxes, are the products of 1D sums
+        std::vector<int> k_shape(_shape.size());
+        for(unsigned int d = 0 ; d < _shape.size() ; ++d)
+            k_shape[d] = _toric ? _shape[d] : 2*_shape[d]-1;
+
+        /// Scaling of the weights
+        if(_toric || !_scale)
+            std::fill(_scaling_factors, _scaling_factors + _size, 1.);
+        else
+            separable_scaling_factors(_shape, _parameters[1], _scaling_factors);
+
+        init_engine(k_shape);
+    }
+
+    if(_lean)
+        release_buffers();
+
+    ++_kernel_version;
+}
+
+void neuralfield::link::Gaussian::init_direct(Direct_Convolution::Workspace & direct_ws, const std::vector<int>& k_shape) {
+    FFTW_Convolution::Convolution_Mode mode = _toric ? FFTW_Convolution::CIRCULAR_SAME : FFTW_Convolution::LINEAR_SAME;
+    double A = _parameters[0];
+    double s = _parameters[1];
+    double normalization = 1.0;
+    for(auto k: k_shape)
+        normalization /= k;
+
+    // 1D fields are handled as a single row
+    // The kernels are truncated at _truncation standard deviations,
+    // a standard deviation spanning s * k_shape cells
+    int h_src = _shape.size() == 2 ? _shape[0] : 1;
+    int w_src = _shape.back();
+    int k_h = _shape.size() == 2 ? k_shape[0] : 1;
+    int k_w = k_shape.back();
+    auto extent = [this, s](int n, int k, int& left, int& right) {
+        int r = int(std::ceil(_truncation * s * k));
+        if(_toric) {
+            left = std::min(r, (n-1)/2);
+            right = std::min(r, n/2);
+        }
+        else
+            left = right = std::min(r, n-1);
+    };
+    int h_left = 0, h_right = 0, w_left, w_right;
+    if(_shape.size() == 2)
+        extent(h_src, k_h, h_left, h_right);
+    extent(w_src, k_w, w_left, w_right);
+
+    // The extents depend on s, the workspace is rebuilt, which does not involve any plan
+    Direct_Convolution::clear_workspace(direct_ws);
+    Direct_Convolution::init_workspace(direct_ws, mode, h_src, w_src, h_left, h_right, w_left, w_right);
+    std::vector<double> kernel_h(h_left + h_right + 1, 1.0);
+    std::vector<double> kernel_w(w_left + w_right + 1);
+    if(_shape.size() == 2)
+        gaussian_profile(k_h, _toric, s, -h_left, h_right, kernel_h.data());
+    gaussian_profile(k_w, _toric, s, -w_left, w_right, kernel_w.data());
+    for(auto& k: kernel_h)
+        k *= A * normalization;
+    Direct_Convolution::set_kernels(direct_ws, kernel_h.data(), kernel_w.data());
+}
+
+void neuralfield::link::Gaussian::init_engine(std::vector<int> k_shape) {
+    // The truncated kernels the sparse sources are convolved with
+    if(_sparse)
+        init_direct(sdws, k_shape);
+
+    if(_reflective) {
+        // The quadrant of the non toric kernel for the offsets 0..N-1 along each axis,
+        // the kernel being null at the offset N
+        int h_src = _shape.size() == 2 ? _shape[0] : 1;
+        int w_src = _shape.back();
+        int c_h = _shape.size() == 2 ? k_shape[0]/2 : 0;
+        int c_w = k_shape.back()/2;
+        std::vector<double> quadrant((h_src+1) * (w_src+1), 0.0);
+        for(int i = 0 ; i < h_src ; ++i)
+            std::copy(kernel + (c_h + i) * k_shape.back() + c_w,
+                      kernel + (c_h + i) * k_shape.back() + c_w + w_src,
+                      quadrant.begin() + i * (w_src+1));
+        if(!cws.in)
+            DCT_Convolution::init_workspace(cws, h_src, w_src, _rigor, _nthreads);
+        DCT_Convolution::compute_kernel_spectrum(cws, quadrant.data());
+        return;
+    }
+
+    FFTW_Convolution::Convolution_Mode mode = _toric ? FFTW_Convolution::CIRCULAR_SAME : FFTW_Convolution::LINEAR_SAME;
+    double A = _parameters[0];
+    double s = _parameters[1];
+    double normalization = 1.0;
+    for(auto k: k_shape)
+        normalization /= k;
+
+    switch(active_engine()) {
+    case SEPARABLE: {
+        // exp(-(dx^2+dy^2)/(2s^2)) = exp(-dx^2/(2s^2)) exp(-dy^2/(2s^2))
+        // the amplitude and normalization are put in the kernel along the columns
+        if(!sws.dst)
+            Separable_Convolution::init_workspace(sws, mode, _shape[0], _shape[1], k_shape[0], k_shape[1], _rigor, _nthreads);
+        std::vector<double> kernel_h(k_shape[0]);
+        std::vector<double> kernel_w(k_shape[1]);
+        int c_h = _toric ? 0 : k_shape[0]/2;
+        int c_w = _toric ? 0 : k_shape[1]/2;
+        gaussian_profile(k_shape[0], _toric, s, -c_h, k_shape[0]-1-c_h, kernel_h.data());
+        gaussian_profile(k_shape[1], _toric, s, -c_w, k_shape[1]-1-c_w, kernel_w.data());
+        for(auto& k: kernel_h)
+            k *= A * normalization;
+        Separable_Convolution::set_kernels(sws, kernel_h.data(), kernel_w.data());
+        break;
+    }
+    case DIRECT:
+        init_direct(dws, k_shape);
+        break;
+    case RECURSIVE: {
+        // A standard deviation spans s * k_shape cells. The recursive filters have
+        // a unit gain, they are scaled by the sum of the sampled exp(-d^2/(2s^2)),
+        // close to sqrt(2 pi) s k_shape along each axis.
+        // A toric kernel only holds the Gaussian up to half the field while the filters
+        // wrap all its tails, its sum is therefore computed explicitly
+        int h_src = _shape.size() == 2 ? _shape[0] : 1;
+        int w_src = _shape.back();
+        double sigma_h = _shape.size() == 2 ? s * k_shape[0] : 0.0;
+        double sigma_w = s * k_shape.back();
+        double gain = A * normalization;
+        for(auto k: k_shape) {
+            if(_toric) {
+                std::vector<double> profile(k);
+                gaussian_profile(k, _toric, s, 0, k-1, profile.data());
+                gain *= std::accumulate(profile.begin(), profile.end(), 0.0);
+            }
+            else
+                gain *= sqrt(2.0 * M_PI) * s * k;
+        }
+        Recursive_Convolution::clear_workspace(rws);
+        Recursive_Convolution::init_workspace(rws, mode, h_src, w_src, sigma_h, sigma_w, gain);
+        break;
+    }
+    case FFT:
+    default: {
+        // The spectrum of the kernels which are not built in space is computed separably
+        bool separable = (_toric && k_shape.size() == 2) || k_shape.size() > 2;
+        if(!ws.in_src) {
+            // 1D fields are handled as a single row, for the 1D real to complex transforms
+            if(_shape.size() <= 2)
+                FFTW_Convolution::init_workspace(ws, mode, _shape.size() == 2 ? _shape[0] : 1, _shape.back(),
+                                                 k_shape.size() == 2 ? k_shape[0] : 1, k_shape.back(), _rigor, _nthreads, 1, !separable);
+            else
+                FFTW_Convolution::init_workspace(ws, mode, _shape, k_shape, _rigor, _nthreads, 1, !separable);
+        }
+        // The kernel only changes with the parameters, we therefore
+        // cache its spectrum rather than transforming it at every update
+        if(separable)
+            separable_kernel_spectrum(ws, k_shape, _toric, A, s);
+        else
+            FFTW_Convolution::compute_kernel_spectrum(ws, kernel);
+        break;
+    }
     }
-    else 
-        throw std::runtime_error("I cannot handle convolution layers in dimension > 2");
 }
 
 neuralfield::link::Gaussian::Gaussian(std::string label,
@@ -122,10 +360,23 @@ neuralfield::link::Gaussian::Gaussian(std::string label,
         std::vector<int> shape):
     neuralfield::function::Layer(label, 2, shape),
     _toric(toric),
+    _reflective(false),
     kernel(0),
-    _scale(scale)
+    _scale(scale),
+    _kernel_version(0),
+    _rigor(FFTW_Convolution::ESTIMATE),
+    _nthreads(1),
+    _engine(FFT),
+    _truncation(4.0),
+    _autotuned(false),
+    _strategy_set(false),
+    _lean(false),
+    _sparse(false),
+    _sparse_threshold(1e-3),
+    _sparse_max_density(0.05),
+    _sparsity(0.0),
+    _sparse_error_bound(0.0)
 {
-    src = new double[_size];
     _scaling_factors = new double[_size];
     _parameters[0] = A;
     _parameters[1] = s;
@@ -134,15 +385,414 @@ neuralfield::link::Gaussian::Gaussian(std::string label,
 }
 
 neuralfield::link::Gaussian::~Gaussian() {
-    FFTW_Convolution::clear_workspace(ws);
+    clear_engines();
     delete[] kernel;
-    delete[] src;
     delete[] _scaling_factors;
 }
 
+bool neuralfield::link::Gaussian::is_toric() const {
+    return _toric;
+}
+
+bool neuralfield::link::Gaussian::is_reflective() const {
+    return _reflective;
+}
+
+void neuralfield::link::Gaussian::set_reflective(bool reflective) {
+    if(reflective && _toric)
+        throw std::invalid_argument("The layer named '" + label() + "' is toric and cannot have reflective borders.");
+    if(reflective && _shape.size() > 2)
+        throw std::invalid_argument("The layer named '" + label() + "' has more than 2 dimensions and cannot have reflective borders.");
+    if(reflective && _sparse)
+        throw std::invalid_argument("The layer named '" + label() + "' is sparse and cannot have reflective borders.");
+    _reflective = reflective;
+    clear_engines();
+    init_convolution();
+}
+
+neuralfield::link::Gaussian::Engine neuralfield::link::Gaussian::engine() const {
+    return _engine;
+}
+
+neuralfield::link::Gaussian::Engine neuralfield::link::Gaussian::active_engine() const {
+    // A 1D kernel is trivially separable, it is convolved with the FFT engine
+    if(_engine == SEPARABLE && _shape.size() != 2)
+        return FFT;
+    // The other engines only handle 1D and 2D fields
+    if(_shape.size() > 2)
+        return FFT;
+    return _engine;
+}
+
+double neuralfield::link::Gaussian::engine_error() const {
+    if(_reflective || active_engine() == FFT)
+        return 0.0;
+
+    // The engine workspaces are modified by the convolutions,
+    // we therefore work on a copy of the layer
+    Gaussian ref(_label, _parameters[0], _parameters[1], _toric, false, _shape);
+    Gaussian other(_label, _parameters[0], _parameters[1], _toric, false, _shape);
+    other._truncation = _truncation;
+    other.set_engine(_engine);
+
+    // The field is drawn from its own generator, leaving std::rand untouched
+    std::vector<double> field(_size);
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for(auto& v: field)
+        v = uniform(generator);
+
+    double * ref_dst = ref.convolve(field.data());
+    double * dst = other.convolve(field.data());
+
+    double max_error = 0.0;
+    double max_value = 0.0;
+    for(unsigned int i = 0 ; i < _size ; ++i) {
+        max_error = std::max(max_error, std::fabs(dst[i] - ref_dst[i]));
+        max_value = std::max(max_value, std::fabs(ref_dst[i]));
+    }
+    return max_value == 0.0 ? max_error : max_error / max_value;
+}
+
+void neuralfield::link::Gaussian::set_engine(Engine engine) {
+    _engine = engine;
+    _autotuned = false;
+    _strategy_set = true;
+    clear_engines();
+    init_convolution();
+}
+
+void neuralfield::link::Gaussian::set_truncation(double nb_sigmas) {
+    _truncation = nb_sigmas;
+    init_convolution();
+}
+
+void neuralfield::link::Gaussian::set_planning_rigor(FFTW_Convolution::Planning_Rigor rigor) {
+    _rigor = rigor;
+    _autotuned = false;
+    _strategy_set = true;
+    clear_engines();
+    init_convolution();
+}
+
+void neuralfield::link::Gaussian::set_fft_threads(int nthreads) {
+    _nthreads = nthreads;
+    clear_engines();
+    init_convolution();
+}
+
+void neuralfield::link::Gaussian::autotune(double tolerance, int nb_runs) {
+    if(_reflective)
+        return;
+
+    // The field is drawn from a local generator not to disturb std::rand
+    std::vector<double> field(_size);
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for(auto& v: field)
+        v = uniform(generator);
+
+    auto configure = [this](Engine engine, FFTW_Convolution::Planning_Rigor rigor) {
+        _engine = engine;
+        _rigor = rigor;
+        clear_engines();
+        init_convolution();
+    };
+
+    // The reference is the exact FFT convolution
+    configure(FFT, FFTW_Convolution::ESTIMATE);
+    double * dst = convolve(field.data());
+    std::vector<double> ref(dst, dst + _size);
+    double max_value = 0.0;
+    for(auto v: ref)
+        max_value = std::max(max_value, std::fabs(v));
+
+    Engine best_engine = FFT;
+    FFTW_Convolution::Planning_Rigor best_rigor = FFTW_Convolution::ESTIMATE;
+    double best_time = -1.0;
+    for(Engine engine: {FFT, SEPARABLE, DIRECT, RECURSIVE}) {
+        if(engine == SEPARABLE && _shape.size() != 2)
+            continue;
+        if(engine != FFT && _shape.size() > 2)
+            continue;
+        bool plans = engine == FFT || engine == SEPARABLE;
+        for(auto rigor: {FFTW_Convolution::ESTIMATE, FFTW_Convolution::MEASURE}) {
+            if(!plans && rigor != FFTW_Convolution::ESTIMATE)
+                continue;
+            configure(engine, rigor);
+
+            // The first run warms the caches up and checks the accuracy
+            dst = convolve(field.data());
+            double max_error = 0.0;
+            for(unsigned int i = 0 ; i < _size ; ++i)
+                max_error = std::max(max_error, std::fabs(dst[i] - ref[i]));
+            if(max_value != 0.0)
+                max_error /= max_value;
+            if(max_error > tolerance)
+                continue;
+
+            auto start = std::chrono::steady_clock::now();
+            for(int r = 0 ; r < nb_runs ; ++r)
+                convolve(field.data());
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if(best_time < 0.0 || elapsed.count() < best_time) {
+                best_time = elapsed.count();
+                best_engine = engine;
+                best_rigor = rigor;
+            }
+        }
+    }
+
+    configure(best_engine, best_rigor);
+    _autotuned = true;
+}
+
+std::string neuralfield::link::Gaussian::strategy() const {
+    if(_reflective)
+        return "DCT";
+
+    std::string s;
+    switch(active_engine()) {
+    case SEPARABLE:
+        s = "SEPARABLE";
+        break;
+    case DIRECT:
+        return "DIRECT";
+    case RECURSIVE:
+        return "RECURSIVE";
+    case FFT:
+    default:
+        s = "FFT";
+        break;
+    }
+    switch(_rigor) {
+    case FFTW_Convolution::MEASURE:
+        return s + "/MEASURE";
+    case FFTW_Convolution::PATIENT:
+        return s + "/PATIENT";
+    case FFTW_Convolution::EXHAUSTIVE:
+        return s + "/EXHAUSTIVE";
+    case FFTW_Convolution::ESTIMATE:
+    default:
+        return s + "/ESTIMATE";
+    }
+}
+
+bool neuralfield::link::Gaussian::is_autotuned() const {
+    return _autotuned;
+}
+
+bool neuralfield::link::Gaussian::is_strategy_set() const {
+    return _strategy_set;
+}
+
+void neuralfield::link::Gaussian::set_memory_lean(bool lean) {
+    _lean = lean;
+    if(_lean)
+        release_buffers();
+    else {
+        clear_engines();
+        init_convolution();
+    }
+}
+
+bool neuralfield::link::Gaussian::is_memory_lean() const {
+    return _lean;
+}
+
+size_t neuralfield::link::Gaussian::memory_saved() const {
+    if(!_lean)
+        return 0;
+
+    // The spatial kernel, which 2D toric layers and higher dimensional layers never build
+    size_t saved = 0;
+    if(_shape.size() == 1 || (!_toric && _shape.size() == 2)) {
+        size_t k_size = 1;
+        for(auto n: _shape)
+            k_size *= _toric ? n : 2*n-1;
+        saved += sizeof(double) * k_size;
+    }
+    // The FFT buffer it is transformed in, if any, and the result, unless they are in a shared scratch
+    if(!_reflective && active_engine() == FFT && ws.owns_scratch)
+        saved += sizeof(double) * ((ws.spatial_kernel ? ws.h_fftw * ws.w_fftw : 0) + ws.channels * ws.h_dst * ws.w_dst);
+    return saved;
+}
+
+void neuralfield::link::Gaussian::set_sparse(bool sparse, double threshold, double max_density) {
+    if(sparse && (_reflective || _shape.size() > 2))
+        throw std::invalid_argument("The layer named '" + label() + "' must be a 1D or 2D field without reflective borders to be sparse.");
+    _sparse = sparse;
+    _sparse_threshold = threshold;
+    _sparse_max_density = max_density;
+    _sparsity = _sparse_error_bound = 0.0;
+    if(_sparse)
+        init_convolution();
+    else
+        Direct_Convolution::clear_workspace(sdws);
+}
+
+bool neuralfield::link::Gaussian::is_sparse() const {
+    return _sparse;
+}
+
+double neuralfield::link::Gaussian::sparsity() const {
+    return _sparsity;
+}
+
+double neuralfield::link::Gaussian::sparse_error_bound() const {
+    return _sparse_error_bound;
+}
+
+bool neuralfield::link::Gaussian::sparse_update(double * field) {
+    // The positions above the threshold, as long as there are not too many of them,
+    // and the sums of the absolute values kept and dropped
+    size_t max_active = size_t(_sparse_max_density * _size);
+    size_t nb_active = 0;
+    double kept = 0.0;
+    double dropped = 0.0;
+    _active.clear();
+    _active_values.clear();
+    for(unsigned int i = 0 ; i < _size ; ++i) {
+        double v = std::fabs(field[i]);
+        if(v < _sparse_threshold) {
+            dropped += v;
+            continue;
+        }
+        kept += v;
+        if(++nb_active <= max_active) {
+            _active.push_back(i);
+            _active_values.push_back(field[i]);
+        }
+    }
+    _sparsity = 1.0 - double(nb_active) / _size;
+    if(nb_active > max_active) {
+        _sparse_error_bound = 0.0;
+        return false;
+    }
+
+    Direct_Convolution::convolve_sparse(sdws, _active.data(), _active_values.data(), _active.size());
+    if(!_scale)
+        std::copy(sdws.dst, sdws.dst + _size, _values.begin());
+    else
+        for(unsigned int i = 0 ; i < _size ; ++i)
+            _values[i] = sdws.dst[i] * _scaling_factors[i];
+
+    // Every dropped value contributes at most the largest weight, |A| / K, to a position
+    // and every kept one at most the largest weight beyond the truncation, where the
+    // distance along one axis at least exceeds _truncation standard deviations
+    double normalization = 1.0;
+    bool truncated = false;
+    int extents[2][2] = {{sdws.h_left, sdws.h_right}, {sdws.w_left, sdws.w_right}};
+    for(unsigned int d = 0 ; d < _shape.size() ; ++d) {
+        int n = _shape[d];
+        normalization /= _toric ? n : 2*n-1;
+        int * e = extents[d + 2 - _shape.size()];
+        truncated |= _toric ? (e[0] + e[1] + 1 < n) : (e[0] < n-1);
+    }
+    double max_weight = std::fabs(_parameters[0]) * normalization;
+    double tail_weight = truncated ? max_weight * exp(-_truncation * _truncation / 2.0) : 0.0;
+    double max_scaling = _scale ? *std::max_element(_scaling_factors, _scaling_factors + _size) : 1.0;
+    _sparse_error_bound = max_scaling * (max_weight * dropped + tail_weight * kept);
+    return true;
+}
+
+size_t neuralfield::link::Gaussian::scratch_size() const {
+    if(_reflective || active_engine() != FFT)
+        return 0;
+    return FFTW_Convolution::scratch_size(ws);
+}
+
+void neuralfield::link::Gaussian::use_scratch(std::shared_ptr<FFTW_Convolution::Scratch> scratch) {
+    if(scratch_size() == 0)
+        return;
+    FFTW_Convolution::use_scratch(ws, *scratch);
+    _scratch = scratch;
+}
+
 void neuralfield::link::Gaussian::set_parameters(std::vector<double> params) {
+    double A = _parameters[0];
+    double s = _parameters[1];
     neuralfield::function::Layer::set_parameters(params);
-    init_convolution();
+
+    // The kernel is linear in A and the scaling factors do not depend on it,
+    // a change of A alone only rescales the kernel
+    if(_parameters[1] == s && _parameters[0] == A)
+        return;
+    if(_parameters[1] == s && A != 0.0)
+        scale_kernel(_parameters[0] / A);
+    else
+        init_convolution();
+}
+
+void neuralfield::link::Gaussian::scale_kernel(double factor) {
+    if(kernel) {
+        int k_size = 1;
+        for(auto n: _shape)
+            k_size *= _toric ? n : 2*n-1;
+        for(double * kptr = kernel ; kptr != kernel + k_size ; ++kptr)
+            *kptr *= factor;
+    }
+
+    if(_sparse)
+        Direct_Convolution::scale_kernels(sdws, factor);
+
+    if(_reflective)
+        DCT_Convolution::scale_kernel_spectrum(cws, factor);
+    else {
+        switch(active_engine()) {
+        case SEPARABLE:
+            Separable_Convolution::scale_kernels(sws, factor);
+            break;
+        case DIRECT:
+            Direct_Convolution::scale_kernels(dws, factor);
+            break;
+        case RECURSIVE:
+            rws.gain *= factor;
+            break;
+        case FFT:
+        default:
+            FFTW_Convolution::scale_kernel_spectrum(ws, factor);
+            break;
+        }
+    }
+    ++_kernel_version;
+}
+
+double * neuralfield::link::Gaussian::convolve(double * field) {
+    if(_reflective) {
+        DCT_Convolution::convolve(cws, field);
+        return cws.dst;
+    }
+
+    double * dst;
+    switch(active_engine()) {
+    case SEPARABLE:
+        Separable_Convolution::convolve(sws, field);
+        dst = sws.dst;
+        break;
+    case DIRECT:
+        Direct_Convolution::convolve(dws, field);
+        dst = dws.dst;
+        break;
+    case RECURSIVE:
+        Recursive_Convolution::convolve(rws, field);
+        dst = rws.dst;
+        break;
+    case FFT:
+    default:
+        if(ws.dst) {
+            FFTW_Convolution::convolve(ws, field);
+            dst = ws.dst;
+        }
+        else {
+            // In the memory lean mode, the result is put in the values of the layer
+            FFTW_Convolution::fftw_circular_convolution(ws, field);
+            FFTW_Convolution::scatter_result(ws, _values.data());
+            dst = _values.data();
+        }
+        break;
+    }
+    return dst;
 }
 
 void neuralfield::link::Gaussian::update() {
@@ -152,15 +802,29 @@ void neuralfield::link::Gaussian::update() {
 
     // Compute the new values for this layer
     auto prev = *(_prevs.begin());
+    if(prev->size() != _size)
+        throw std::runtime_error("The layer named '" + label() + "' and its previous layer have different sizes.");
+
+    // The engines read the values of the previous layer in place
+    double * field = &(*prev->begin());
 
-    std::copy(prev->begin(), prev->end(), src);
-    FFTW_Convolution::convolve(ws, src, kernel);
+    if(_sparse && sparse_update(field))
+        return;
+
+    if(!_reflective && active_engine() == FFT) {
+        // The result is scaled and scattered straight from the FFT buffer
+        FFTW_Convolution::fftw_circular_convolution(ws, field);
+        FFTW_Convolution::scatter_result(ws, _values.data(), _scale ? _scaling_factors : 0);
+        return;
+    }
+
+    double * dst = convolve(field);
 
     if(!_scale) {
-        std::copy(ws.dst, ws.dst + _size, _values.begin());
+        std::copy(dst, dst + _size, _values.begin());
     }
     else {
-        double* dst_ptr = ws.dst;
+        double* dst_ptr = dst;
         double* it_s = _scaling_factors;
         for(auto& v: _values) {
             v = (*dst_ptr) * (*it_s);
@@ -204,11 +868,462 @@ std::shared_ptr<neuralfield::function::Layer> neuralfield::link::gaussian(double
 
 
 
+neuralfield::link::GaussianSum::GaussianSum(std::string label,
+        std::vector<std::shared_ptr<neuralfield::link::Gaussian> > kernels):
+    neuralfield::function::Layer(label, 2*kernels.size(), kernels.empty() ? std::vector<int>() : kernels.front()->shape()),
+    _kernels(kernels),
+    _kernel_versions(kernels.size()),
+    _scale(false),
+    _nb_summed(0),
+    _product(0)
+{
+    if(_kernels.empty())
+        throw std::invalid_argument("The layer named '" + label + "' requires at least one kernel.");
+
+    auto& front = _kernels.front();
+    for(auto& k: _kernels) {
+        if(k->shape() != front->shape() || k->_toric != front->_toric)
+            throw std::invalid_argument("The kernels of the layer named '" + label + "' must have the same shape and toricity.");
+        if(k->active_engine() != Gaussian::FFT || k->_reflective)
+            throw std::invalid_argument("The kernels of the layer named '" + label + "' must use the FFT engine without reflective borders.");
+        _scale |= (!k->_toric && k->_scale);
+    }
+    for(auto& k: _kernels)
+        if(!is_separate(*k))
+            ++_nb_summed;
+
+    init_convolution();
+}
+
+neuralfield::link::GaussianSum::~GaussianSum() {
+    FFTW_Convolution::clear_workspace(ws);
+    fftw_free(_product);
+}
+
+bool neuralfield::link::GaussianSum::is_separate(const Gaussian& k) const {
+    return _scale || k._label != "";
+}
+
+const std::vector<std::shared_ptr<neuralfield::link::Gaussian> >& neuralfield::link::GaussianSum::kernels() const {
+    return _kernels;
+}
+
+void neuralfield::link::GaussianSum::init_convolution() {
+    // All the kernels share the same workspace geometry
+    auto& kws = _kernels.front()->ws;
+    FFTW_Convolution::clear_workspace(ws);
+    _scratch.reset();
+    FFTW_Convolution::init_workspace(ws, kws.mode,
+                                     std::vector<int>(kws.n_src, kws.n_src + kws.rank),
+                                     std::vector<int>(kws.n_kernel, kws.n_kernel + kws.rank),
+                                     kws.rigor, kws.nthreads, 1, false);
+    // The summed spectrum is then kept in ws.out_kernel until the last product
+    fftw_free(_product);
+    _product = 0;
+    if(_nb_summed != 0 && _nb_summed != int(_kernels.size()))
+        _product = (double*) fftw_malloc(sizeof(fftw_complex) * ws.h_fftw * (ws.w_fftw/2+1));
+    sum_spectra();
+}
+
+size_t neuralfield::link::GaussianSum::scratch_size() const {
+    size_t size = FFTW_Convolution::scratch_size(ws);
+    for(auto& k: _kernels)
+        size = std::max(size, k->scratch_size());
+    return size;
+}
+
+void neuralfield::link::GaussianSum::use_scratch(std::shared_ptr<FFTW_Convolution::Scratch> scratch) {
+    FFTW_Convolution::use_scratch(ws, *scratch);
+    _scratch = scratch;
+    for(auto& k: _kernels)
+        k->use_scratch(scratch);
+}
+
+void neuralfield::link::GaussianSum::sum_spectra() {
+    auto it_params = _parameters.begin();
+    auto it_versions = _kernel_versions.begin();
+    for(auto& k: _kernels) {
+        *(it_params++) = k->_parameters[0];
+        *(it_params++) = k->_parameters[1];
+        *(it_versions++) = k->_kernel_version;
+    }
+
+    for(auto& k: _kernels)
+        if(k->active_engine() != Gaussian::FFT || k->_reflective)
+            throw std::runtime_error("The kernels of the layer named '" + label() + "' must use the FFT engine without reflective borders.");
+
+    // Without any summed kernel, e.g. with border scaling,
+    // ws.out_kernel is only used as a scratch buffer
+    if(_nb_summed == 0)
+        return;
+
+    int spectrum_size = 2 * ws.h_fftw * (ws.w_fftw/2+1);
+    std::fill(ws.out_kernel, ws.out_kernel + spectrum_size, 0.0);
+    for(auto& k: _kernels) {
+        if(is_separate(*k))
+            continue;
+        double * kptr = k->ws.out_kernel;
+        for(double * sptr = ws.out_kernel; sptr != ws.out_kernel + spectrum_size; ++sptr, ++kptr)
+            *sptr += *kptr;
+    }
+}
+
+void neuralfield::link::GaussianSum::set_planning_rigor(FFTW_Convolution::Planning_Rigor rigor) {
+    for(auto& k: _kernels)
+        k->set_planning_rigor(rigor);
+    init_convolution();
+}
+
+void neuralfield::link::GaussianSum::set_fft_threads(int nthreads) {
+    for(auto& k: _kernels)
+        k->set_fft_threads(nthreads);
+    init_convolution();
+}
+
+void neuralfield::link::GaussianSum::set_parameters(std::vector<double> params) {
+    neuralfield::function::Layer::set_parameters(params);
+    auto it_params = _parameters.begin();
+    for(auto& k: _kernels) {
+        k->set_parameters({*it_params, *(it_params+1)});
+        it_params += 2;
+    }
+    sum_spectra();
+}
+
+void neuralfield::link::GaussianSum::update() {
+    if(_prevs.size() != 1) {
+        throw std::runtime_error("The layer named '" + label() + "' should be connected to one layer.");
+    }
+
+    // The kernels may have been modified directly
+    auto it_versions = _kernel_versions.begin();
+    for(auto& k: _kernels)
+        if(k->_kernel_version != *(it_versions++)) {
+            sum_spectra();
+            break;
+        }
+
+    auto prev = *(_prevs.begin());
+    if(prev->size() != _size)
+        throw std::runtime_error("The layer named '" + label() + "' and its previous layer have different sizes.");
+    FFTW_Convolution::transform_source(ws, &(*prev->begin()));
+
+    // The kernels applied separately come first, ws.out_src being preserved for the next ones
+    bool first = true;
+    double * product = _product ? _product : ws.out_kernel;
+    for(auto& k: _kernels) {
+        if(!is_separate(*k))
+            continue;
+        double * scaling = k->_scale ? k->_scaling_factors : 0;
+        FFTW_Convolution::spectral_product(ws, k->ws.out_kernel, product);
+        FFTW_Convolution::backward_transform(ws, product);
+        if(k->label() == "")
+            FFTW_Convolution::scatter_result(ws, _values.data(), scaling, !first);
+        else {
+            // The values of a labelled kernel can be read as those of an unmerged layer
+            FFTW_Convolution::scatter_result(ws, k->_values.data(), scaling);
+            if(first)
+                std::copy(k->_values.begin(), k->_values.end(), _values.begin());
+            else
+                std::transform(_values.begin(), _values.end(), k->_values.begin(), _values.begin(), std::plus<double>());
+        }
+        first = false;
+    }
+
+    // Then the sum of the others, in place
+    if(_nb_summed != 0) {
+        FFTW_Convolution::spectral_product(ws, ws.out_kernel, ws.out_src);
+        FFTW_Convolution::backward_transform(ws, ws.out_src);
+        FFTW_Convolution::scatter_result(ws, _values.data(), 0, !first);
+    }
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::gaussian_sum(std::vector<double> amplitudes,
+        std::vector<double> sigmas,
+        bool toric,
+        bool scale,
+        std::vector<int> shape,
+        std::string label) {
+    if(amplitudes.size() != sigmas.size())
+        throw std::invalid_argument("gaussian_sum expects as many amplitudes as variances");
+
+    // The kernels are owned by the sum and are not registered in the network
+    std::vector<std::shared_ptr<neuralfield::link::Gaussian> > kernels;
+    for(unsigned int i = 0 ; i < amplitudes.size(); ++i)
+        kernels.push_back(std::make_shared<neuralfield::link::Gaussian>("", amplitudes[i], sigmas[i], toric, scale, shape));
+
+    auto l = std::make_shared<neuralfield::link::GaussianSum>(label, kernels);
+    auto net = neuralfield::get_current_network();
+    net += l;
+    return l;
+}
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::gaussian_sum(std::vector<double> amplitudes,
+        std::vector<double> sigmas,
+        bool toric,
+        bool scale,
+        int size,
+        std::string label) {
+    return neuralfield::link::gaussian_sum(amplitudes, sigmas, toric, scale, std::vector<int>({size}), label);
+}
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::gaussian_sum(std::vector<double> amplitudes,
+        std::vector<double> sigmas,
+        bool toric,
+        bool scale,
+        int size1,
+        int size2,
+        std::string label) {
+    return neuralfield::link::gaussian_sum(amplitudes, sigmas, toric, scale, std::vector<int>({size1, size2}), label);
+}
+
+
+
+
+neuralfield::link::ChannelGaussian::ChannelGaussian(std::string label,
+        double A,
+        double s,
+        bool toric,
+        bool scale,
+        std::vector<int> shape,
+        int channels,
+        bool mixing):
+    neuralfield::function::Layer(label, mixing ? 2 + channels*channels : 2, shape, channels),
+    _toric(toric),
+    _scale(scale && !toric),
+    _rigor(FFTW_Convolution::ESTIMATE),
+    _nthreads(1),
+    _mixing(mixing)
+{
+    _parameters[0] = A;
+    _parameters[1] = s;
+    // The channels are not mixed until the weights are set
+    if(_mixing)
+        for(int c = 0 ; c < channels ; ++c)
+            _parameters[2 + c*channels + c] = 1.0;
+    init_convolution();
+}
+
+neuralfield::link::ChannelGaussian::~ChannelGaussian() {
+    FFTW_Convolution::clear_workspace(ws);
+}
+
+std::vector<int> neuralfield::link::ChannelGaussian::kernel_shape() const {
+    // The same geometry than the FFT engine of Gaussian,
+    // 1D fields being handled as a single row
+    std::vector<int> k_shape;
+    if(_shape.size() == 1)
+        k_shape.push_back(1);
+    for(auto n: _shape)
+        k_shape.push_back(_toric ? n : 2*n-1);
+    return k_shape;
+}
+
+void neuralfield::link::ChannelGaussian::init_convolution() {
+    std::vector<int> shape = _shape;
+    if(shape.size() == 1)
+        shape.insert(shape.begin(), 1);
+    FFTW_Convolution::Convolution_Mode mode = _toric ? FFTW_Convolution::CIRCULAR_SAME : FFTW_Convolution::LINEAR_SAME;
+    FFTW_Convolution::clear_workspace(ws);
+    _scratch.reset();
+    // The kernel is never built in space, only its spectrum is computed, separably
+    FFTW_Convolution::init_workspace(ws, mode, shape, kernel_shape(), _rigor, _nthreads, _channels, false);
+    init_kernel();
+}
+
+void neuralfield::link::ChannelGaussian::init_kernel() {
+    separable_kernel_spectrum(ws, kernel_shape(), _toric, _parameters[0], _parameters[1]);
+    if(_scale) {
+        _scaling_factors.resize(_size / _channels);
+        separable_scaling_factors(_shape, _parameters[1], _scaling_factors.data());
+    }
+    _kernel_parameters = {_parameters[0], _parameters[1]};
+}
+
+size_t neuralfield::link::ChannelGaussian::scratch_size() const {
+    return FFTW_Convolution::scratch_size(ws);
+}
+
+void neuralfield::link::ChannelGaussian::use_scratch(std::shared_ptr<FFTW_Convolution::Scratch> scratch) {
+    FFTW_Convolution::use_scratch(ws, *scratch);
+    _scratch = scratch;
+}
+
+void neuralfield::link::ChannelGaussian::set_planning_rigor(FFTW_Convolution::Planning_Rigor rigor) {
+    _rigor = rigor;
+    init_convolution();
+}
+
+void neuralfield::link::ChannelGaussian::set_fft_threads(int nthreads) {
+    _nthreads = nthreads;
+    init_convolution();
+}
+
+void neuralfield::link::ChannelGaussian::set_parameters(std::vector<double> params) {
+    neuralfield::function::Layer::set_parameters(params);
+    // Changing the mixing weights does not require to rebuild the kernel
+    if(_kernel_parameters[0] != _parameters[0] || _kernel_parameters[1] != _parameters[1])
+        init_kernel();
+}
+
+void neuralfield::link::ChannelGaussian::update() {
+    if(_prevs.size() != 1) {
+        throw std::runtime_error("The layer named '" + label() + "' should be connected to one layer.");
+    }
+
+    auto prev = *(_prevs.begin());
+    if(prev->size() != _size)
+        throw std::runtime_error("The layer named '" + label() + "' and its previous layer have different numbers of channels.");
+
+    FFTW_Convolution::transform_source(ws, &(*prev->begin()));
+    FFTW_Convolution::spectral_product(ws, ws.out_kernel, ws.out_src);
+    FFTW_Convolution::backward_transform(ws, ws.out_src);
+
+    double * scaling = _scale ? _scaling_factors.data() : 0;
+    if(!_mixing) {
+        FFTW_Convolution::scatter_result(ws, _values.data(), scaling);
+        return;
+    }
+
+    // ws.dst holds the convolved channels which are then mixed
+    FFTW_Convolution::scatter_result(ws, ws.dst, scaling);
+    int field_size = _size / _channels;
+    const double * weights = _parameters.data() + 2;
+    for(int c = 0 ; c < _channels ; ++c) {
+        double * __restrict__ out = _values.data() + c * field_size;
+        std::fill(out, out + field_size, 0.0);
+        for(int d = 0 ; d < _channels ; ++d) {
+            double w = weights[c * _channels + d];
+            if(w == 0.0)
+                continue;
+            const double * __restrict__ in = ws.dst + d * field_size;
+            for(int i = 0 ; i < field_size ; ++i)
+                out[i] += w * in[i];
+        }
+    }
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::channel_gaussian(double A,
+        double s,
+        bool toric,
+        bool scale,
+        std::vector<int> shape,
+        int channels,
+        std::vector<double> mixing,
+        std::string label) {
+    bool with_mixing = !mixing.empty();
+    if(with_mixing && mixing.size() != (unsigned int)(channels * channels))
+        throw std::invalid_argument("channel_gaussian expects channels x channels mixing weights");
+
+    auto l = std::make_shared<neuralfield::link::ChannelGaussian>(label, A, s, toric, scale, shape, channels, with_mixing);
+    if(with_mixing) {
+        std::vector<double> params({A, s});
+        params.insert(params.end(), mixing.begin(), mixing.end());
+        l->set_parameters(params);
+    }
+    auto net = neuralfield::get_current_network();
+    net += l;
+    return l;
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::channel_gaussian(double A,
+        double s,
+        bool toric,
+        bool scale,
+        int size,
+        int channels,
+        std::vector<double> mixing,
+        std::string label) {
+    return neuralfield::link::channel_gaussian(A, s, toric, scale, std::vector<int>({size}), channels, mixing, label);
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::channel_gaussian(double A,
+        double s,
+        bool toric,
+        bool scale,
+        int size1,
+        int size2,
+        int channels,
+        std::vector<double> mixing,
+        std::string label) {
+    return neuralfield::link::channel_gaussian(A, s, toric, scale, std::vector<int>({size1, size2}), channels, mixing, label);
+}
+
+neuralfield::link::GlobalInhibition::GlobalInhibition(std::string label,
+        double A,
+        bool toric,
+        std::vector<int> shape):
+    neuralfield::function::Layer(label, 1, shape),
+    _toric(toric)
+{
+    _parameters[0] = A;
+    _normalization = 1.0;
+    for(auto n: _shape)
+        _normalization /= _toric ? n : 2*n-1;
+}
+
+bool neuralfield::link::GlobalInhibition::is_toric() const {
+    return _toric;
+}
+
+double neuralfield::link::GlobalInhibition::flatness_error(double s, bool toric, std::vector<int> shape) {
+    // The distances are normalized as for the gaussian kernels. Without wrapping,
+    // the kernel spans 2n-1 cells but two positions are at most n-1 apart
+    double d2 = 0.0;
+    for(auto n: shape) {
+        if(toric) {
+            const std::vector<double>& table = neuralfield::distances::squared_distances_1D(n, true);
+            d2 += *std::max_element(table.begin(), table.end());
+        }
+        else {
+            int k = 2*n-1;
+            d2 += neuralfield::distances::squared_distances_1D(k, false)[(n-1) + k-1];
+        }
+    }
+    return 1.0 - exp(-d2 / (2.0 * s*s));
+}
+
+void neuralfield::link::GlobalInhibition::update() {
+    if(_prevs.size() != 1) {
+        throw std::runtime_error("The layer named '" + label() + "' should be connected to one layer.");
+    }
+
+    auto prev = *(_prevs.begin());
+    if(prev->size() != _size)
+        throw std::runtime_error("The layer named '" + label() + "' and its previous layer have different sizes.");
+
+    double total = FFTW_Convolution::sum(&(*prev->begin()), int(_size));
+    std::fill(_values.begin(), _values.end(), _parameters[0] * _normalization * total);
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::global_inhibition(double A,
+        bool toric,
+        std::vector<int> shape,
+        std::string label) {
+    auto l = std::make_shared<neuralfield::link::GlobalInhibition>(label, A, toric, shape);
+    auto net = neuralfield::get_current_network();
+    net += l;
+    return l;
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::global_inhibition(double A,
+        bool toric,
+        int size,
+        std::string label) {
+    return neuralfield::link::global_inhibition(A, toric, std::vector<int>({size}), label);
+}
+
+std::shared_ptr<neuralfield::function::Layer> neuralfield::link::global_inhibition(double A,
+        bool toric,
+        int size1,
+        int size2,
+        std::string label) {
+    return neuralfield::link::global_inhibition(A, toric, std::vector<int>({size1, size2}), label);
+}
+
 neuralfield::link::SumLayer::SumLayer(std::string label,
         std::shared_ptr<neuralfield::layer::Layer> l1,
         std::shared_ptr<neuralfield::layer::Layer> l2):
-    neuralfield::function::Layer(label, 0, l1->shape()){
-        assert(l1->shape() == l2->shape());
+    neuralfield::function::Layer(label, 0, l1->shape(), l1->channels()){
+        assert(l1->shape() == l2->shape() && l1->channels() == l2->channels());
         connect(l1);
         connect(l2);
     }
@@ -35,22 +35,84 @@
 #include "layers.hpp"
 #include "function_layers.hpp"
 #include "types.hpp"
+#include "convolution_separable.hpp"
+#include "convolution_direct.hpp"
+#include "convolution_recursive.hpp"
+#include "convolution_dct.hpp"
 
 namespace neuralfield {
   namespace link {
 
+    class GaussianSum;
+
     class Gaussian : public neuralfield::function::Layer {
+
+    public:
+      // How the convolution is computed
+      //   FFT : a 2D FFT of the, possibly padded, field, or an N-dimensional FFT for the fields
+      //         of more than 2 dimensions, which are always convolved with this engine
+      //   SEPARABLE : a 1D convolution along the rows and then along the columns
+      //               of the unpadded field, each computed with FFTs or directly
+      //   DIRECT : a direct separable convolution with the kernel truncated
+      //            at a few standard deviations, for the narrow kernels
+      //   RECURSIVE : the recursive approximation of the Gaussian filter, which cost
+      //               does not depend on the width of the kernel, for the wide kernels
+      enum Engine {
+	FFT,
+	SEPARABLE,
+	DIRECT,
+	RECURSIVE
+      };
       
     protected:
       FFTW_Convolution::Workspace ws;
+      Separable_Convolution::Workspace sws;
+      Direct_Convolution::Workspace dws;
+      Recursive_Convolution::Workspace rws;
+      DCT_Convolution::Workspace cws;
       bool _toric;
+      bool _reflective;
       double * kernel;
-      double * src;
       bool _scale;
       //double * _scaling_factors;
+      unsigned int _kernel_version; // incremented every time the kernel is rebuilt
+      FFTW_Convolution::Planning_Rigor _rigor;
+      int _nthreads;
+      Engine _engine;
+      double _truncation; // in number of standard deviations, for the DIRECT engine
+      bool _autotuned; // whether the engine and the rigor have been chosen by autotune
+      bool _strategy_set; // whether they have been chosen with set_engine or set_planning_rigor
+      bool _lean; // whether the spatial kernel and the buffers it is transformed with are released
+      std::shared_ptr<FFTW_Convolution::Scratch> _scratch; // The temporary buffers of ws, if shared
+      Direct_Convolution::Workspace sdws; // The truncated kernels of the sparse mode
+      bool _sparse;
+      double _sparse_threshold;
+      double _sparse_max_density;
+      double _sparsity; // measured at the last update
+      double _sparse_error_bound; // bound of the error of the last update
+      std::vector<int> _active; // The positions of the source above the threshold
+      std::vector<double> _active_values;
 
     private:
+      // Rebuild the kernel and hand it to the engine ; the workspaces which
+      // do not depend on the parameters are kept from one call to the other
       void init_convolution();
+      void init_engine(std::vector<int> k_shape);
+      // Truncate the kernels as the DIRECT engine does and put them in direct_ws
+      void init_direct(Direct_Convolution::Workspace & direct_ws, const std::vector<int>& k_shape);
+      // Release the workspaces, for them to be rebuilt by init_convolution
+      // when the engine, the borders, the rigor or the threads change
+      void clear_engines();
+      // Release, in the memory lean mode, what the convolutions do not need
+      void release_buffers();
+      // Multiply the kernel, and its representation in the engine, by factor
+      void scale_kernel(double factor);
+      Engine active_engine() const;
+
+      // Convolve field with the active engine and return the result
+      double * convolve(double * field);
+      // Compute the values from the sparse field, unless it is too dense
+      bool sparse_update(double * field);
       
     public:
       double * _scaling_factors;
@@ -64,8 +126,91 @@ namespace neuralfield {
       
       ~Gaussian();
 
+      bool is_toric() const;
+      bool is_reflective() const;
+
+      // A non toric field can be mirrored at its borders rather than padded with zeros
+      // The convolution is then computed with DCTs of the unpadded field, whatever the engine,
+      // the border scaling is not applied and the layer cannot be part of a GaussianSum
+      // This is only available for 1D and 2D fields
+      void set_reflective(bool reflective);
+      Engine engine() const;
+
+      // The engine only makes a difference for 2D fields
+      // The other engines than FFT do not provide the kernel spectrum
+      // and their layers cannot be part of a GaussianSum
+      void set_engine(Engine engine);
+
+      // The largest difference between the convolution computed by the engine
+      // and by the FFT, relative to the largest absolute value of the latter,
+      // for a random field. This is 0 for the FFT engine and with reflective borders.
+      // The RECURSIVE engine is typically within a few percents
+      // when the standard deviation spans more than a couple of cells
+      double engine_error() const;
+
+      // The DIRECT engine truncates the kernel at nb_sigmas standard deviations (4 by default)
+      void set_truncation(double nb_sigmas);
+
+      // Measuring the plans (e.g. MEASURE or PATIENT) takes time when the
+      // convolution is initialized but usually provides faster transforms
+      // \sa FFTW_Convolution::set_wisdom_filename
+      void set_planning_rigor(FFTW_Convolution::Planning_Rigor rigor);
+
+      // The transforms are executed with nthreads threads
+      // if the library has been built with the multithreaded FFTW
+      void set_fft_threads(int nthreads);
+
+      // Time the convolution of a random field, over nb_runs runs, with every engine
+      // and, for the engines which plan FFTs, with the ESTIMATE and MEASURE rigors.
+      // The fastest strategy whose engine_error-like difference with the FFT
+      // stays within tolerance is kept. Reflective layers always use the DCTs.
+      // The DIRECT engine typically differs by a few 1e-4 with its default truncation
+      // and the RECURSIVE one by 1e-3 or more : a tolerance below these keeps
+      // the FFT based engines only. This overrides the engine and the rigor
+      // set with set_engine and set_planning_rigor.
+      void autotune(double tolerance, int nb_runs=5);
+
+      // The engine and the planning rigor in use, e.g. "FFT/MEASURE"
+      std::string strategy() const;
+      bool is_autotuned() const;
+      bool is_strategy_set() const;
+
+      // The layers evaluated one after the other can share the temporary buffers of
+      // their FFTs, only keeping their kernel spectrum. scratch_size is the size,
+      // in doubles, of these buffers, 0 if the layer does not use the FFT.
+      // The buffers are owned again by the layer after a change of engine, borders,
+      // rigor or threads. \sa FFTW_Convolution::use_scratch
+      size_t scratch_size() const;
+      void use_scratch(std::shared_ptr<FFTW_Convolution::Scratch> scratch);
+
+      // In the memory lean mode, the layer only keeps the kernel spectrum, or the
+      // engine kernels, and the scaling factors. The spatial kernel and the buffer
+      // it is transformed with are rebuilt when the parameters change and freed afterwards.
+      // memory_saved is the number of bytes released by this mode
+      void set_memory_lean(bool lean);
+      bool is_memory_lean() const;
+      size_t memory_saved() const;
+
+      // In the sparse mode, the values of the source below threshold, in absolute value,
+      // are dropped. When at most a fraction max_density of the source remains, the result
+      // is built by scattering around the remaining positions the kernels truncated
+      // as by the DIRECT engine ; the denser sources are convolved with the engine.
+      // This is an approximation for the sources holding a few localized bumps, only
+      // available for 1D and 2D fields without reflective borders. The sparse layers
+      // are not fused in a GaussianSum.
+      void set_sparse(bool sparse, double threshold=1e-3, double max_density=0.05);
+      bool is_sparse() const;
+      // The fraction of the source below the threshold at the last update
+      double sparsity() const;
+      // An analytic bound of the absolute error of the last update at every position, due to
+      // the dropped values and the truncation of the kernels, not a measure against the engine ;
+      // 0 if it has used the engine
+      double sparse_error_bound() const;
+
       void set_parameters(std::vector<double> params) override;
       void update() override;  
+
+      friend class GaussianSum;
     };
 
     
@@ -93,6 +238,200 @@ namespace neuralfield {
 							   std::string label= "");
       
 
+    /*! \class GaussianSum
+     * @brief The sum of several gaussian links applied to the same source
+     * The source is transformed once and multiplied by the sum of the kernel spectra
+     * before a single backward transform. When some kernels are scaled at the borders,
+     * the scaling factors differ from one kernel to another and
+     * one backward transform per kernel is performed.
+     * The labelled kernels, e.g. the layers merged by Network::init, are backward
+     * transformed on their own as well and their values are kept up to date
+     * The parameters are [A0, s0, A1, s1, ...]
+     */
+    class GaussianSum : public neuralfield::function::Layer {
+      
+    protected:
+      std::vector<std::shared_ptr<Gaussian> > _kernels;
+      std::vector<unsigned int> _kernel_versions;
+      FFTW_Convolution::Workspace ws;
+      bool _scale;
+      std::shared_ptr<FFTW_Convolution::Scratch> _scratch;
+      int _nb_summed; // The number of kernels which spectra are summed in ws.out_kernel
+      double * _product; // The products of the kernels applied separately, if ws.out_kernel is in use
+
+    private:
+      void init_convolution();
+      void sum_spectra();
+      // Whether the kernel is backward transformed on its own
+      bool is_separate(const Gaussian& k) const;
+      
+    public:
+      GaussianSum(std::string label,
+		  std::vector<std::shared_ptr<Gaussian> > kernels);
+
+      ~GaussianSum();
+
+      const std::vector<std::shared_ptr<Gaussian> >& kernels() const;
+
+      void set_planning_rigor(FFTW_Convolution::Planning_Rigor rigor);
+      void set_fft_threads(int nthreads);
+
+      // \sa Gaussian::use_scratch ; the kernels share the scratch as well
+      size_t scratch_size() const;
+      void use_scratch(std::shared_ptr<FFTW_Convolution::Scratch> scratch);
+
+      void set_parameters(std::vector<double> params) override;
+      void update() override;
+    };
+
+    std::shared_ptr<neuralfield::function::Layer> gaussian_sum(std::vector<double> amplitudes,
+							       std::vector<double> sigmas,
+							       bool toric,
+							       bool scale,
+							       std::vector<int> shape,
+							       std::string label="");
+
+    std::shared_ptr<neuralfield::function::Layer> gaussian_sum(std::vector<double> amplitudes,
+							       std::vector<double> sigmas,
+							       bool toric,
+							       bool scale,
+							       int size,
+							       std::string label="");
+
+    std::shared_ptr<neuralfield::function::Layer> gaussian_sum(std::vector<double> amplitudes,
+							       std::vector<double> sigmas,
+							       bool toric,
+							       bool scale,
+							       int size1,
+							       int size2,
+							       std::string label="");
+
+    /*! \class ChannelGaussian
+     * @brief The gaussian link applied to every channel of a multi-channel field
+     * All the channels are transformed together with batched plans and multiplied
+     * by the same kernel spectrum. The convolved channels can then be mixed,
+     * the channel c of the result being sum_d w_cd (k * in_d).
+     * The parameters are [A, s] followed, with mixing, by the C x C weights w_cd, row major
+     */
+    class ChannelGaussian : public neuralfield::function::Layer {
+
+    protected:
+      FFTW_Convolution::Workspace ws; // Holds the spectrum of the kernel, never built in space
+      bool _toric;
+      bool _scale;
+      std::vector<double> _scaling_factors;
+      std::vector<double> _kernel_parameters; // The [A, s] the kernel spectrum is computed with
+      FFTW_Convolution::Planning_Rigor _rigor;
+      int _nthreads;
+      bool _mixing;
+      std::shared_ptr<FFTW_Convolution::Scratch> _scratch;
+
+    private:
+      std::vector<int> kernel_shape() const;
+      void init_convolution();
+      void init_kernel();
+
+    public:
+      ChannelGaussian(std::string label,
+		      double A,
+		      double s,
+		      bool toric,
+		      bool scale,
+		      std::vector<int> shape,
+		      int channels,
+		      bool mixing=false);
+
+      ~ChannelGaussian();
+
+      void set_planning_rigor(FFTW_Convolution::Planning_Rigor rigor);
+      void set_fft_threads(int nthreads);
+
+      // \sa Gaussian::use_scratch
+      size_t scratch_size() const;
+      void use_scratch(std::shared_ptr<FFTW_Convolution::Scratch> scratch);
+
+      void set_parameters(std::vector<double> params) override;
+      void update() override;
+    };
+
+    // Without mixing weights, the channels are convolved independently
+    // Otherwise, mixing holds the C x C weights, row major
+    std::shared_ptr<neuralfield::function::Layer> channel_gaussian(double A,
+								   double s,
+								   bool toric,
+								   bool scale,
+								   std::vector<int> shape,
+								   int channels,
+								   std::vector<double> mixing={},
+								   std::string label="");
+
+    std::shared_ptr<neuralfield::function::Layer> channel_gaussian(double A,
+								   double s,
+								   bool toric,
+								   bool scale,
+								   int size,
+								   int channels,
+								   std::vector<double> mixing={},
+								   std::string label="");
+
+    std::shared_ptr<neuralfield::function::Layer> channel_gaussian(double A,
+								   double s,
+								   bool toric,
+								   bool scale,
+								   int size1,
+								   int size2,
+								   int channels,
+								   std::vector<double> mixing={},
+								   std::string label="");
+
+    /*! \class GlobalInhibition
+     * @brief The link with a uniform kernel, the limit of a gaussian link which
+     * standard deviation is large with respect to the field : every position receives
+     * A / K times the sum of the source, K being the size of the kernel of the gaussian
+     * link of the same shape and toricity, i.e. prod N_i if toric and prod (2 N_i - 1) otherwise.
+     * It costs a single reduction of the source instead of a convolution.
+     * The sum of the weights is the same from every position, this is therefore
+     * also exactly the border scaled link.
+     * The parameter is [A]
+     */
+    class GlobalInhibition : public neuralfield::function::Layer {
+
+    protected:
+      bool _toric;
+      double _normalization; // 1 / K
+
+    public:
+      GlobalInhibition(std::string label,
+		       double A,
+		       bool toric,
+		       std::vector<int> shape);
+
+      bool is_toric() const;
+
+      // The largest relative difference between the weights of a gaussian link
+      // of standard deviation s and the uniform ones, 1 - exp(-d^2 / (2 s^2)), d being
+      // the largest distance between two positions of the field
+      static double flatness_error(double s, bool toric, std::vector<int> shape);
+
+      void update() override;
+    };
+
+    std::shared_ptr<neuralfield::function::Layer> global_inhibition(double A,
+								    bool toric,
+								    std::vector<int> shape,
+								    std::string label="");
+
+    std::shared_ptr<neuralfield::function::Layer> global_inhibition(double A,
+								    bool toric,
+								    int size,
+								    std::string label="");
+
+    std::shared_ptr<neuralfield::function::Layer> global_inhibition(double A,
+								    bool toric,
+								    int size1,
+								    int size2,
+								    std::string label="");
+
     class SumLayer: public neuralfield::function::Layer {
       
     public:
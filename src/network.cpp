@@ -1,4 +1,5 @@
 #include "network.hpp"
+#include "link_layers.hpp"
 
 std::shared_ptr<neuralfield::Network> neuralfield::Network::current_network;
 
@@ -53,7 +54,134 @@ void neuralfield::Network::register_labelled_layer(std::shared_ptr<neuralfield::
 neuralfield::Network::Network() {
 }
 
-void neuralfield::Network::init() {
+unsigned int neuralfield::Network::count_consumers(std::shared_ptr<neuralfield::layer::Layer> layer) {
+  unsigned int nb_consumers = 0;
+  for(auto l: _function_layers) {
+    auto& prevs = l->prevs();
+    if(std::find(prevs.begin(), prevs.end(), layer) != prevs.end())
+      ++nb_consumers;
+  }
+  for(auto l: _buffered_layers)
+    if(l->prev() == layer)
+      ++nb_consumers;
+  return nb_consumers;
+}
+
+// Look for a SumLayer of two convolutions of the same source,
+// each of them being only used by this sum, and replace it by a link::GaussianSum
+// Since the convolution is linear, the kernels can be summed in the spectral domain.
+// The merged layers are kept labelled so that their parameters can still be set
+// and the GaussianSum keeps the values of the labelled kernels up to date.
+// A labelled GaussianSum is not merged since its own values would not be.
+// Returns true if a fusion has been performed
+bool neuralfield::Network::fuse_convolutions() {
+  for(auto l: _function_layers) {
+    auto sum = std::dynamic_pointer_cast<neuralfield::link::SumLayer>(l);
+    if(!sum)
+      continue;
+
+    std::shared_ptr<neuralfield::layer::Layer> source;
+    std::vector<std::shared_ptr<neuralfield::link::Gaussian> > kernels;
+    std::list<std::shared_ptr<neuralfield::function::Layer> > terms;
+    bool can_fuse = true;
+    for(auto prev: sum->prevs()) {
+      std::shared_ptr<neuralfield::function::Layer> term;
+      if(auto g = std::dynamic_pointer_cast<neuralfield::link::Gaussian>(prev)) {
+	term = g;
+	kernels.push_back(g);
+      }
+      else if(auto gs = std::dynamic_pointer_cast<neuralfield::link::GaussianSum>(prev)) {
+	if(gs->label() != "") {
+	  can_fuse = false;
+	  break;
+	}
+	term = gs;
+	kernels.insert(kernels.end(), gs->kernels().begin(), gs->kernels().end());
+      }
+      else {
+	can_fuse = false;
+	break;
+      }
+
+      if(term->prevs().size() != 1 || count_consumers(term) != 1
+	 || (source && term->prevs().front() != source)) {
+	can_fuse = false;
+	break;
+      }
+      source = term->prevs().front();
+      terms.push_back(term);
+    }
+
+    for(auto k: kernels)
+      can_fuse &= (k->is_toric() == kernels.front()->is_toric()) && (k->shape() == kernels.front()->shape())
+	&& (k->engine() == neuralfield::link::Gaussian::FFT) && !k->is_reflective() && !k->is_sparse();
+    
+    if(!can_fuse)
+      continue;
+
+    auto fused = std::make_shared<neuralfield::link::GaussianSum>(sum->label(), kernels);
+    fused->connect(source);
+
+    // The fused layer takes the place of the sum
+    for(auto c: _function_layers)
+      c->replace_prev(sum, fused);
+    for(auto c: _buffered_layers)
+      if(c->prev() == sum)
+	c->connect(fused);
+    if(sum->label() != "")
+      _labelled_layers[sum->label()] = fused;
+
+    _function_layers.remove(sum);
+    for(auto t: terms)
+      _function_layers.remove(t);
+    _function_layers.push_back(fused);
+    return true;
+  }
+  return false;
+}
+
+// The layers being evaluated one after the other, the FFT convolutions
+// put their temporary buffers in a single scratch sized for the largest of them
+void neuralfield::Network::share_scratch() {
+  size_t size = 0;
+  for(auto l: _function_layers) {
+    if(auto g = std::dynamic_pointer_cast<neuralfield::link::Gaussian>(l))
+      size = std::max(size, g->scratch_size());
+    else if(auto gs = std::dynamic_pointer_cast<neuralfield::link::GaussianSum>(l))
+      size = std::max(size, gs->scratch_size());
+    else if(auto gc = std::dynamic_pointer_cast<neuralfield::link::ChannelGaussian>(l))
+      size = std::max(size, gc->scratch_size());
+  }
+  if(size == 0)
+    return;
+
+  auto scratch = std::make_shared<FFTW_Convolution::Scratch>(size);
+  for(auto l: _function_layers) {
+    if(auto g = std::dynamic_pointer_cast<neuralfield::link::Gaussian>(l))
+      g->use_scratch(scratch);
+    else if(auto gs = std::dynamic_pointer_cast<neuralfield::link::GaussianSum>(l))
+      gs->use_scratch(scratch);
+    else if(auto gc = std::dynamic_pointer_cast<neuralfield::link::ChannelGaussian>(l))
+      gc->use_scratch(scratch);
+  }
+}
+
+void neuralfield::Network::init(bool optimize, bool autotune, double tolerance) {
+
+  // Merge the convolutions which share the same source
+  if(optimize)
+    while(fuse_convolutions());
+
+  // The merged convolutions keep the FFT they are summed with
+  // and the strategies set by hand are kept as well
+  if(autotune)
+    for(auto l: _function_layers)
+      if(auto g = std::dynamic_pointer_cast<neuralfield::link::Gaussian>(l))
+	if(!g->is_strategy_set())
+	  g->autotune(tolerance);
+
+  // The layers being evaluated one after the other, this never changes their values
+  share_scratch();
 
   // We reorder the function layers in order to
   // evaluate them in the "correct order"
@@ -127,6 +255,17 @@ void neuralfield::Network::step() {
     l->update();
 }
 
+void neuralfield::Network::set_fft_threads(int nthreads) {
+  for(auto l: _function_layers) {
+    if(auto g = std::dynamic_pointer_cast<neuralfield::link::Gaussian>(l))
+      g->set_fft_threads(nthreads);
+    else if(auto gs = std::dynamic_pointer_cast<neuralfield::link::GaussianSum>(l))
+      gs->set_fft_threads(nthreads);
+    else if(auto gc = std::dynamic_pointer_cast<neuralfield::link::ChannelGaussian>(l))
+      gc->set_fft_threads(nthreads);
+  }
+}
+
 std::shared_ptr<neuralfield::layer::Layer> neuralfield::Network::get(std::string label) {
   auto it = _labelled_layers.find(label);
   if(it == _labelled_layers.end())
@@ -151,8 +290,24 @@ void neuralfield::Network::print(void) {
   for(auto l: _input_layers)
     std::cout << "     '" << l->label() << "'" << std::endl;
   std::cout << "  " << _function_layers.size() << " function layers " << std::endl;
-  for(auto l: _function_layers)
-    std::cout << "     '" << l->label() << "'" << std::endl;
+  for(auto l: _function_layers) {
+    std::cout << "     '" << l->label() << "'";
+    if(auto g = std::dynamic_pointer_cast<neuralfield::link::Gaussian>(l)) {
+      std::cout << " (" << g->strategy() << (g->is_autotuned() ? ", autotuned" : "");
+      if(g->is_memory_lean())
+	std::cout << ", lean : " << g->memory_saved() << " bytes saved";
+      if(g->is_sparse())
+	std::cout << ", sparse";
+      std::cout << ")";
+    }
+    else if(auto gs = std::dynamic_pointer_cast<neuralfield::link::GaussianSum>(l)) {
+      std::cout << " (kernels";
+      for(auto k: gs->kernels())
+	std::cout << " '" << k->label() << "'";
+      std::cout << ")";
+    }
+    std::cout << std::endl;
+  }
   std::cout << "  " << _buffered_layers.size() << " buffered layers " << std::endl;
   for(auto l: _buffered_layers)
     std::cout << "     '" << l->label() << "'" << std::endl;
@@ -59,16 +59,35 @@ namespace neuralfield {
     
     void register_labelled_layer(std::shared_ptr<neuralfield::layer::Layer> layer);
 
+    unsigned int count_consumers(std::shared_ptr<neuralfield::layer::Layer> layer);
+    bool fuse_convolutions();
+    void share_scratch();
+
     static std::shared_ptr<Network> current_network;
     
   public:
     
     Network();
 
-    void init();
+    // If optimize is true, the sums of convolutions of the same source
+    // are merged into a single link::GaussianSum, which transforms the source once
+    // The labelled layers which are merged keep their values up to date,
+    // at the cost of one backward transform each, and their labels remain
+    // valid for setting their parameters
+    // The FFT convolutions always share a single scratch for their temporary buffers
+    // If autotune is true, every link::Gaussian which has not been merged
+    // and which engine or planning rigor has not been set by hand is set
+    // with the fastest strategy whose relative error stays within tolerance
+    // The default tolerance admits the DIRECT engine, not usually the RECURSIVE one
+    // \sa link::Gaussian::autotune ; the strategies are shown by print()
+    void init(bool optimize=true, bool autotune=false, double tolerance=1e-3);
     void reset();
     void step();
     void print();
+
+    // Execute the transforms of all the convolution layers
+    // currently in the network with nthreads threads
+    void set_fft_threads(int nthreads);
     
     std::shared_ptr<neuralfield::layer::Layer> get(std::string label);
     std::shared_ptr<neuralfield::layer::Layer> operator[](std::string label);
@@ -28,6 +28,9 @@
 #include <random>
 #include <cstdlib>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
 
 namespace neuralfield {
   namespace random {
@@ -106,6 +109,28 @@ namespace neuralfield {
 
       }
 
+      /**
+       * @brief The squared distances of the offsets -(k-1), ..., k-1 along an axis of size k,
+       * normalized by k as in make_euclidean_1D
+       * @return a table which element o + k - 1 is the squared distance of the offset o
+       * The tables are computed once per (k, toric) and shared by all the layers
+       */
+      inline const std::vector<double>& squared_distances_1D(int k, bool toric) {
+          static std::map<std::pair<int, bool>, std::vector<double>> tables;
+          static std::mutex mutex;
+          std::lock_guard<std::mutex> lock(mutex);
+
+          auto& table = tables[std::make_pair(k, toric)];
+          if(table.empty()) {
+              table.resize(2*k-1);
+              for(int o = -(k-1) ; o <= k-1 ; ++o) {
+                  double d = toric ? std::min(std::abs(o), k - std::abs(o)) : std::abs(o);
+                  table[o + k - 1] = (d / k) * (d / k);
+              }
+          }
+          return table;
+      }
+
   }
 }
 